@@ -1,30 +1,63 @@
 #define _POSIX_C_SOURCE 200809L
 
+#include <dlfcn.h>
 #include <errno.h>
 #include <limits.h>
 #include <signal.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "builtins.h"
+#include "builtins_phash.h"
 #include "exit.h"
 #include "jobs.h"
+#include "parallel.h"
 #include "params.h"
+#include "pathcache.h"
+#include "profile.h"
+#include "signal.h"
+#include "spawn.h"
+#include "stats.h"
+#include "timers.h"
+#include "timing.h"
+#include "trace.h"
+#include "util/alloc.h"
+#include "util/phash.h"
 #include "vars.h"
 #include "wait.h"
 
-/** Gets the real fd of a pseudo redirect
- *
- *  Builtins use pseudo-redirection to avoid accidentally changing
- *  the shell's actual open files. This is implemented as a virtual
- *  layer (pseudo-fds) on top of the existing file descriptor system.
- *
- * dprintf(get_pseudo_fd(redir_list, STDOUT_FILENO), ...)
- * dprintf(get_pseudo_fd(redir_list, STDERR_FILENO), ...)
- */
-static int
+extern char **environ;
+
+#define BUILTIN(name, flags) \
+    static int builtin_##name(struct command *cmd, struct builtin_redir const *redir_list);
+#include "builtins.def"
+#undef BUILTIN
+
+static struct builtin {
+    char const *name;
+    builtin_fn fn;
+    int flags;
+} const core_builtins[] = {
+#define BUILTIN(name, flags) {#name, builtin_##name, flags},
+#include "builtins.def"
+#undef BUILTIN
+};
+
+/* Builtins loaded with `enable -f` */
+static struct loaded_builtin {
+    char *name;
+    char *file;
+    builtin_fn fn;
+    int flags;
+    void *handle;
+} *loaded_builtins = 0;
+static size_t loaded_count = 0;
+
+int
 get_pseudo_fd(struct builtin_redir const *redir_list, int fd) {
     for (; redir_list; redir_list = redir_list->next) {
         if (redir_list->realfd == fd) return -1;
@@ -52,7 +85,8 @@ builtin_null(struct command *cmd, struct builtin_redir const *redir_list) {
  *
  * if path is omitted, change to $HOME directory.
  *
- * Updates $PWD shell variable
+ * Updates $PWD shell variable, and drops cached command paths if $PATH
+ * has entries relative to the old directory
  *
  * It is an error if too many arguments are provided, or if the chdir operation
  * fails
@@ -77,6 +111,7 @@ builtin_cd(struct command *cmd, struct builtin_redir const *redir_list) {
         dprintf(get_pseudo_fd(redir_list, STDERR_FILENO), "cd: %s\n", strerror(errno));
         return -1;
     }
+    pathcache_chdir();
 
     return vars_set("PWD", target_dir);
 }
@@ -156,12 +191,12 @@ static int
 builtin_fg(struct command *cmd, struct builtin_redir const *redir_list) {
     jid_t job_id = -1;
     if (cmd->word_count == 1) {
-        size_t job_count = jobs_get_joblist_size();
-        if (job_count == 0) {
+        struct job const *job = jobs_next(-1);
+        if (!job) {
             dprintf(get_pseudo_fd(redir_list, STDERR_FILENO), "No jobs\n");
             return -1;
         }
-        job_id = jobs_get_joblist()[0].jid;
+        job_id = job->jid;
     } else if (cmd->word_count == 2) {
         char *end = cmd->words[1];
         long val = strtol(cmd->words[1], &end, 10);
@@ -187,6 +222,7 @@ builtin_fg(struct command *cmd, struct builtin_redir const *redir_list) {
         goto err;
     }
     kill(-pgid, SIGCONT);
+    jobs_continue(job_id);
 
     if (wait_on_fg_job(job_id) < 0) goto err;
 
@@ -202,9 +238,9 @@ static int
 builtin_bg(struct command *cmd, struct builtin_redir const *redir_list) {
     jid_t job_id = -1;
     if (cmd->word_count == 1) {
-        size_t job_count = jobs_get_joblist_size();
-        if (job_count == 0) return -1;
-        job_id = jobs_get_joblist()[0].jid;
+        struct job const *job = jobs_next(-1);
+        if (!job) return -1;
+        job_id = job->jid;
     } else if (cmd->word_count == 2) {
         char *end = cmd->words[1];
         long val = strtol(cmd->words[1], &end, 10);
@@ -230,6 +266,7 @@ builtin_bg(struct command *cmd, struct builtin_redir const *redir_list) {
         goto err;
     }
     kill(-pgid, SIGCONT);
+    jobs_continue(job_id);
 
     return 0;
     err:
@@ -237,23 +274,498 @@ builtin_bg(struct command *cmd, struct builtin_redir const *redir_list) {
     return -1;
 }
 
-/** prints a list of background jobs
+/** prints a list of background jobs, to stdout so it can be piped
  *
  * @returns 0 (always succeeds)
  */
 static int
 builtin_jobs(struct command *cmd, struct builtin_redir const *redir_list) {
-    size_t job_count = jobs_get_joblist_size();
-    struct job const *jobs = jobs_get_joblist();
-    for (size_t i = 0; i < job_count; ++i) {
-        dprintf(get_pseudo_fd(redir_list, STDERR_FILENO),
-                "[%jd] %jd\n",
-                (intmax_t) jobs[i].jid,
-                (intmax_t) jobs[i].pgid);
+    int const fd = get_pseudo_fd(redir_list, STDOUT_FILENO);
+    for (struct job const *job = jobs_next(-1); job; job = jobs_next(job->jid)) {
+        if (jobs_get_state(job->jid) == JOB_QUEUED) {
+            dprintf(fd, "[%jd] queued\n", (intmax_t) job->jid);
+            continue;
+        }
+        dprintf(fd, "[%jd] %jd\n", (intmax_t) job->jid, (intmax_t) job->pgid);
+    }
+    return 0;
+}
+
+/* An operand of wait: a whole job, or one of its processes */
+struct wait_target {
+    jid_t jid;
+    pid_t pid; /* 0 for the whole job */
+};
+
+/** Checks if a wait target has finished
+ *
+ * @param [out]status its exit status, once finished
+ * @returns 1 if finished, 0 if not, -1 if it's not (or no longer) a job
+ */
+static int
+wait_target_done(struct wait_target const *t, int *status) {
+    if (t->pid) {
+        jid_t jid = -1;
+        struct process const *proc = jobs_get_process(t->pid, &jid);
+        if (!proc) return -1;
+        if (proc->state != PROC_DONE) return 0;
+        *status = wait_exit_status(proc->status);
+        return 1;
+    }
+
+    int state = jobs_get_state(t->jid);
+    if (state < 0) return -1;
+    if (state != JOB_DONE) return 0;
+    *status = wait_job_exit_status(t->jid);
+    return 1;
+}
+
+/** Forgets a job if it's done, so it isn't reported as Done later */
+static void
+wait_forget(jid_t jid) {
+    if (jobs_get_state(jid) != JOB_DONE) return;
+    timing_report(jid);
+    jobs_remove(jid);
+}
+
+/** Waits for background jobs to finish
+ *
+ * @returns the exit status of the last job or process waited for; 127 if one
+ *          isn't a job, 130 if interrupted, -1 on failure
+ *
+ * wait [-n] [%job|pid...]
+ *
+ * Without operands, waits for every running job and returns 0. With -n,
+ * returns as soon as any of the operands (or any job at all) finishes.
+ * Jobs waited for are forgotten without being reported as Done.
+ */
+static int
+builtin_wait(struct command *cmd, struct builtin_redir const *redir_list) {
+    int const errfd = get_pseudo_fd(redir_list, STDERR_FILENO);
+    int any = 0;
+    size_t first = 1;
+    if (first < cmd->word_count && strcmp(cmd->words[first], "-n") == 0) {
+        any = 1;
+        ++first;
+    }
+
+    size_t const count = cmd->word_count - first;
+    struct wait_target *targets = calloc(count + 1, sizeof *targets);
+    if (!targets) goto err;
+    for (size_t i = 0; i < count; ++i) {
+        char const *arg = cmd->words[first + i];
+        char const *num = arg[0] == '%' ? arg + 1 : arg;
+        char *end = 0;
+        long val = strtol(num, &end, 10);
+        if (*end || !*num || val < (arg[0] == '%' ? 0 : 1) || val > INT_MAX) {
+            dprintf(errfd, "wait: `%s': %s\n", arg, strerror(EINVAL));
+            free(targets);
+            return -1;
+        }
+        if (arg[0] == '%') targets[i].jid = val;
+        else targets[i].pid = val;
+    }
+
+    int result = count ? 127 : 0;
+    size_t next = 0; /* Operand being waited for, when not -n */
+    if (signal_enable_interrupt(SIGINT) < 0) goto err;
+    for (;;) {
+        if (wait_reap() < 0) goto err_sigint;
+
+        int pending = 0;
+        if (count == 0) {
+            for (struct job const *job = jobs_next(-1); job;) {
+                jid_t const jid = job->jid;
+                int state = jobs_get_state(jid);
+                job = jobs_next(jid);
+                if (state == JOB_RUNNING || state == JOB_QUEUED) {
+                    pending = 1;
+                } else if (state == JOB_DONE) {
+                    int const status = wait_job_exit_status(jid);
+                    wait_forget(jid);
+                    if (any) {
+                        result = status;
+                        goto out;
+                    }
+                }
+            }
+            if (!pending) {
+                /* With -n and nothing left to finish, there's nothing to wait for */
+                if (any) result = 127;
+                goto out;
+            }
+        } else {
+            for (size_t i = any ? 0 : next; i < count; ++i) {
+                jid_t jid = targets[i].jid;
+                if (targets[i].pid) jobs_get_process(targets[i].pid, &jid);
+                int status = 0;
+                int done = wait_target_done(&targets[i], &status);
+                if (done == 0) {
+                    pending = 1;
+                    if (any) continue;
+                    break;
+                }
+                result = done > 0 ? status : 127;
+                if (done > 0) wait_forget(jid);
+                if (any && done > 0) goto out;
+                if (!any) next = i + 1;
+            }
+            if (!pending) goto out;
+        }
+
+        if (wait_for_child() < 0) {
+            if (errno != EINTR) goto err_sigint;
+            result = 130;
+            goto out;
+        }
+    }
+
+    out:
+    free(targets);
+    if (signal_ignore(SIGINT) < 0) return -1;
+    return result;
+
+    err_sigint:
+    signal_ignore(SIGINT);
+    err:
+    dprintf(errfd, "wait: %s\n", strerror(errno));
+    free(targets);
+    return -1;
+}
+
+/** Runs a command for each of a list of arguments, several at a time
+ *
+ * @returns the exit status described in parallel.h
+ *
+ * parallel [-j N] [-k] [--joblog FILE] [--halt soon|now] cmd [args...] [::: arg...]
+ *
+ * Runs in a child of its own (BUILTIN_SUBSHELL), which stands in for the job
+ * and has its redirections performed for real (BUILTIN_SHELL_REDIRS).
+ */
+static int
+builtin_parallel(struct command *cmd, struct builtin_redir const *redir_list) {
+    if (signal_restore() < 0) return -1;
+    return parallel_run(&cmd->words[1], cmd->word_count - 1);
+}
+
+/** Pauses for the total of the given durations
+ *
+ * @returns 0 after sleeping, 130 if interrupted, -1 on bad usage
+ *
+ * sleep DURATION...
+ *
+ * Durations are seconds, optionally fractional, or suffixed with m, h or d.
+ * In the foreground this runs in the shell itself, which goes on reaping
+ * children meanwhile: queued jobs start as others finish, and job timeouts
+ * falling due are handled on time.
+ */
+static int
+builtin_sleep(struct command *cmd, struct builtin_redir const *redir_list) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    if (cmd->word_count < 2) goto usage;
+    for (size_t i = 1; i < cmd->word_count; ++i) {
+        struct timespec ts;
+        if (timers_parse_duration(cmd->words[i], &ts) < 0) goto usage;
+        deadline.tv_sec += ts.tv_sec;
+        deadline.tv_nsec += ts.tv_nsec;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_nsec -= 1000000000L;
+            ++deadline.tv_sec;
+        }
+    }
+
+    int result = 0;
+    if (signal_enable_interrupt(SIGINT) < 0) return -1;
+    if (wait_until(deadline) < 0) result = errno == EINTR ? 130 : -1;
+    if (signal_ignore(SIGINT) < 0) return -1;
+    return result;
+
+    usage:
+    dprintf(get_pseudo_fd(redir_list, STDERR_FILENO), "usage: sleep DURATION...\n");
+    return -1;
+}
+
+/** Times a command
+ *
+ * @returns 125 (always fails)
+ *
+ * time [-p] command...
+ *
+ * Well-formed uses are stripped off the command by the runner, which reports
+ * on its job when it's done (see timing.h); this only reports those that
+ * aren't.
+ */
+static int
+builtin_time(struct command *cmd, struct builtin_redir const *redir_list) {
+    dprintf(get_pseudo_fd(redir_list, STDERR_FILENO), "usage: time [-p] command...\n");
+    return 125;
+}
+
+/** Runs a command on a given set of CPUs
+ *
+ * @returns 125 (always fails)
+ *
+ * pin CPUS command...
+ *
+ * Like time, well-formed uses are stripped off the command by the runner,
+ * which applies them in its child (see placement.h).
+ */
+static int
+builtin_pin(struct command *cmd, struct builtin_redir const *redir_list) {
+    dprintf(get_pseudo_fd(redir_list, STDERR_FILENO), "usage: pin CPUS command...\n");
+    return 125;
+}
+
+/** Replaces the shell with a command, or redirects the shell's own files
+ *
+ * @returns 0 on success, -1 on failure; never returns if a command is given
+ *
+ * exec [command [args...]]
+ *
+ * Redirections have already been performed on the shell itself (this builtin
+ * is BUILTIN_SHELL_REDIRS), so `exec >>log` keeps the log open for every
+ * command that follows, without reopening it each time. With a command,
+ * assignments are exported to it and the shell's signal dispositions are
+ * restored before it replaces the shell.
+ */
+static int
+builtin_exec(struct command *cmd, struct builtin_redir const *redir_list) {
+    if (cmd->word_count == 1) return 0;
+
+    /* The assignments go into the command's environment alone, so a failed
+     * exec leaves the shell's exports as they were */
+    char **owned = calloc(cmd->assignment_count + 1, sizeof *owned);
+    char **env = owned ? spawn_env(cmd, owned) : 0;
+    if (env && signal_restore() == 0) {
+        stats_add(STATS_EXECS, 1);
+        stats_dump();
+        profile_dump();
+        if (trace_buffer) trace_record(TRACE_EXEC, getpid(), getpgrp(), 0, cmd->words[1]);
+        /* Swapped in, so execvp() also searches an assigned PATH */
+        char **const shell_env = environ;
+        environ = env;
+        execvp(cmd->words[1], &cmd->words[1]);
+        environ = shell_env;
+        int saved_errno = errno;
+        signal_init();
+        errno = saved_errno;
+    }
+
+    dprintf(get_pseudo_fd(redir_list, STDERR_FILENO),
+            "exec: %s: %s\n",
+            cmd->words[1],
+            strerror(errno));
+    for (size_t i = 0; env && i < cmd->assignment_count; ++i) free(owned[i]);
+    free(owned);
+    free(env);
+    return -1;
+}
+
+/** Prints the shell's own counters and timings
+ *
+ * @returns 0 on success, -1 on failure
+ *
+ * stats       as text
+ * stats -j    as one line of JSON
+ *
+ * See stats.h for what they cover; $MS_STATS_FILE gets the JSON on exit.
+ */
+static int
+builtin_stats(struct command *cmd, struct builtin_redir const *redir_list) {
+    int json = 0;
+    if (cmd->word_count == 2 && strcmp(cmd->words[1], "-j") == 0) {
+        json = 1;
+    } else if (cmd->word_count != 1) {
+        dprintf(get_pseudo_fd(redir_list, STDERR_FILENO), "usage: stats [-j]\n");
+        return -1;
+    }
+    return stats_print(get_pseudo_fd(redir_list, STDOUT_FILENO), json);
+}
+
+/** Prints memory allocated by each of the shell's subsystems
+ *
+ * @returns 0 on success, -1 on failure
+ *
+ * memstats       as text
+ * memstats -j    as one line of JSON
+ *
+ * Only debug builds keep the accounts; see util/alloc.h.
+ */
+static int
+builtin_memstats(struct command *cmd, struct builtin_redir const *redir_list) {
+    int json = 0;
+    if (cmd->word_count == 2 && strcmp(cmd->words[1], "-j") == 0) {
+        json = 1;
+    } else if (cmd->word_count != 1) {
+        dprintf(get_pseudo_fd(redir_list, STDERR_FILENO), "usage: memstats [-j]\n");
+        return -1;
+    }
+    if (alloc_print(get_pseudo_fd(redir_list, STDOUT_FILENO), json) < 0) {
+        dprintf(get_pseudo_fd(redir_list, STDERR_FILENO), "memstats: %s\n",
+                errno == ENOTSUP ? "not kept in release builds" : strerror(errno));
+        return -1;
     }
     return 0;
 }
 
+/** Remembers where commands are found
+ *
+ * @returns 0 on success, -1 if a command isn't found
+ *
+ * hash          lists the cached commands, with their hit counts
+ * hash -r       forgets all cached commands
+ * hash name...  looks up each command now, and caches it
+ */
+static int
+builtin_hash(struct command *cmd, struct builtin_redir const *redir_list) {
+    if (cmd->word_count == 1) {
+        pathcache_print(get_pseudo_fd(redir_list, STDOUT_FILENO));
+        return 0;
+    }
+
+    size_t i = 1;
+    if (strcmp(cmd->words[1], "-r") == 0) {
+        pathcache_clear();
+        ++i;
+    }
+
+    int result = 0;
+    for (; i < cmd->word_count; ++i) {
+        if (strchr(cmd->words[i], '/')) continue;
+        pathcache_forget(cmd->words[i]);
+        if (!pathcache_lookup(cmd->words[i])) {
+            dprintf(get_pseudo_fd(redir_list, STDERR_FILENO), "hash: %s: not found\n", cmd->words[i]);
+            result = -1;
+        }
+    }
+    return result;
+}
+
+/** Loads a builtin from a shared object
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static int
+load_builtin(char const *file, char const *name, int err_fd) {
+    char *symbol = 0;
+    void *handle = 0;
+    struct command probe = {.words = (char **) &name, .word_count = 1};
+    if (get_builtin(&probe)) {
+        dprintf(err_fd, "enable: %s: already a builtin\n", name);
+        return -1;
+    }
+
+    size_t len = strlen(name);
+    symbol = malloc(len + sizeof "_builtin_flags");
+    if (!symbol) goto err;
+    handle = dlopen(file, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        dprintf(err_fd, "enable: %s\n", dlerror());
+        goto fail;
+    }
+
+    sprintf(symbol, "%s_builtin", name);
+    builtin_fn fn = (builtin_fn) dlsym(handle, symbol);
+    if (!fn) {
+        dprintf(err_fd, "enable: %s: no %s in %s\n", name, symbol, file);
+        goto fail;
+    }
+    strcat(symbol, "_flags");
+    int const *flags = dlsym(handle, symbol);
+
+    void *tmp = realloc(loaded_builtins, sizeof *loaded_builtins * (loaded_count + 1));
+    if (!tmp) goto err;
+    loaded_builtins = tmp;
+    struct loaded_builtin *b = &loaded_builtins[loaded_count];
+    b->name = strdup(name);
+    b->file = strdup(file);
+    if (!b->name || !b->file) {
+        free(b->name);
+        free(b->file);
+        goto err;
+    }
+    b->fn = fn;
+    b->flags = flags ? *flags : 0;
+    b->handle = handle;
+    ++loaded_count;
+    free(symbol);
+    return 0;
+
+    err:
+    dprintf(err_fd, "enable: %s\n", strerror(errno));
+    fail:
+    if (handle) dlclose(handle);
+    free(symbol);
+    return -1;
+}
+
+/** Unloads a builtin loaded with `enable -f`
+ *
+ * @returns 0 on success, -1 if there is no such loaded builtin
+ */
+static int
+unload_builtin(char const *name, int err_fd) {
+    for (size_t i = 0; i < loaded_count; ++i) {
+        if (strcmp(name, loaded_builtins[i].name) != 0) continue;
+        free(loaded_builtins[i].name);
+        free(loaded_builtins[i].file);
+        dlclose(loaded_builtins[i].handle);
+        memmove(&loaded_builtins[i],
+                &loaded_builtins[i + 1],
+                sizeof *loaded_builtins * (loaded_count - i - 1));
+        --loaded_count;
+        return 0;
+    }
+    dprintf(err_fd, "enable: %s: not a loaded builtin\n", name);
+    return -1;
+}
+
+/** Lists, loads, or unloads builtins
+ *
+ * @returns 0 on success, -1 on failure
+ *
+ * enable
+ * enable -f file name...
+ * enable -d name...
+ *
+ * With no arguments, lists all builtins; loaded ones are shown with the file
+ * they came from.
+ */
+static int
+builtin_enable(struct command *cmd, struct builtin_redir const *redir_list) {
+    int const out_fd = get_pseudo_fd(redir_list, STDOUT_FILENO);
+    int const err_fd = get_pseudo_fd(redir_list, STDERR_FILENO);
+
+    if (cmd->word_count == 1) {
+        for (size_t i = 0; i < sizeof core_builtins / sizeof *core_builtins; ++i) {
+            dprintf(out_fd, "enable %s\n", core_builtins[i].name);
+        }
+        for (size_t i = 0; i < loaded_count; ++i) {
+            dprintf(out_fd,
+                    "enable -f %s %s\n",
+                    loaded_builtins[i].file,
+                    loaded_builtins[i].name);
+        }
+        return 0;
+    }
+
+    int result = 0;
+    if (strcmp(cmd->words[1], "-f") == 0 && cmd->word_count >= 4) {
+        for (size_t i = 3; i < cmd->word_count; ++i) {
+            if (load_builtin(cmd->words[2], cmd->words[i], err_fd) < 0) result = -1;
+        }
+    } else if (strcmp(cmd->words[1], "-d") == 0 && cmd->word_count >= 3) {
+        for (size_t i = 2; i < cmd->word_count; ++i) {
+            if (unload_builtin(cmd->words[i], err_fd) < 0) result = -1;
+        }
+    } else {
+        dprintf(err_fd, "usage: enable [-f file name... | -d name...]\n");
+        return -1;
+    }
+    return result;
+}
+
 /** built-in function selector method
  *
  * @param cmd the command under consideration
@@ -264,12 +776,25 @@ builtin_jobs(struct command *cmd, struct builtin_redir const *redir_list) {
 builtin_fn
 get_builtin(struct command *cmd) {
     if (cmd->word_count == 0) return builtin_null;
-    else if (strcmp(cmd->words[0], "cd") == 0) return builtin_cd;
-    else if (strcmp(cmd->words[0], "exit") == 0) return builtin_exit;
-    else if (strcmp(cmd->words[0], "fg") == 0) return builtin_fg;
-    else if (strcmp(cmd->words[0], "bg") == 0) return builtin_bg;
-    else if (strcmp(cmd->words[0], "jobs") == 0) return builtin_jobs;
-    else if (strcmp(cmd->words[0], "unset") == 0) return builtin_unset;
-    else if (strcmp(cmd->words[0], "export") == 0) return builtin_export;
-    else return 0;
+    char const *name = cmd->words[0];
+
+    unsigned char i = builtin_phash_slots[phash(name, BUILTIN_PHASH_SEED) & (BUILTIN_PHASH_SIZE - 1)];
+    if (i && strcmp(name, core_builtins[i - 1].name) == 0) return core_builtins[i - 1].fn;
+
+    for (size_t j = 0; j < loaded_count; ++j) {
+        if (strcmp(name, loaded_builtins[j].name) == 0) return loaded_builtins[j].fn;
+    }
+    return 0;
+}
+
+int
+builtin_flags(builtin_fn builtin) {
+    if (builtin == builtin_null) return BUILTIN_PURE;
+    for (size_t i = 0; i < sizeof core_builtins / sizeof *core_builtins; ++i) {
+        if (core_builtins[i].fn == builtin) return core_builtins[i].flags;
+    }
+    for (size_t i = 0; i < loaded_count; ++i) {
+        if (loaded_builtins[i].fn == builtin) return loaded_builtins[i].flags;
+    }
+    return 0;
 }
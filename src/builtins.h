@@ -10,10 +10,60 @@ struct builtin_redir {
 
 typedef int (*builtin_fn)(struct command *, struct builtin_redir const *redir);
 
+/* Builtin flags */
+enum {
+    BUILTIN_PURE = 1 << 0,        /* Leaves the shell's state alone */
+    BUILTIN_SHELL_REDIRS = 1 << 1, /* Redirections apply to the shell itself */
+    BUILTIN_SUBSHELL = 1 << 2,     /* Always runs in a child, as its own job */
+};
+
 /** Look up corresponding builtin function for a given command
  *  Built-ins simulate real programs while running entirely with-
  *  in the shell itself. They can perform important tasks that
  *  are not possible with separate child processes.
+ *
+ *  Core builtins are found through a perfect hash generated at build
+ *  time, then builtins loaded with `enable -f`.
  */
 extern builtin_fn get_builtin(struct command *cmd);
 
+/** Gets the real fd of a pseudo redirect
+ *
+ *  Builtins use pseudo-redirection to avoid accidentally changing
+ *  the shell's actual open files. This is implemented as a virtual
+ *  layer (pseudo-fds) on top of the existing file descriptor system.
+ *
+ * dprintf(get_pseudo_fd(redir_list, STDOUT_FILENO), ...)
+ * dprintf(get_pseudo_fd(redir_list, STDERR_FILENO), ...)
+ *
+ * @returns the real fd, or -1 if the pseudo-fd is closed
+ */
+extern int get_pseudo_fd(struct builtin_redir const *redir_list, int fd);
+
+/* Loadable builtins
+ *
+ * `enable -f lib.so name` loads a builtin from a shared object exporting
+ *
+ *   int name_builtin(struct command *, struct builtin_redir const *);
+ *
+ * and, optionally, `int const name_builtin_flags` holding BUILTIN_* flags.
+ * The function follows the same rules as core builtins: it writes through
+ * get_pseudo_fd() and returns 0 on success, -1 on failure, or a positive
+ * exit status of its own.
+ */
+
+/** Gets the BUILTIN_* flags of a builtin
+ *
+ * BUILTIN_PURE builtins can run within the shell even where a real shell
+ * would use a subshell, e.g. as a pipeline stage.
+ *
+ * BUILTIN_SHELL_REDIRS builtins get no pseudo-redirections: their
+ * redirections are performed on the shell's real file descriptors, and stay.
+ * Given arguments, e.g. `exec cmd >log`, they're undone if the builtin
+ * returns.
+ *
+ * BUILTIN_SUBSHELL builtins are forked like external commands even in the
+ * foreground, e.g. to manage children of their own as a single job. Combined
+ * with BUILTIN_SHELL_REDIRS, their redirections apply to that child.
+ */
+extern int builtin_flags(builtin_fn builtin);
@@ -6,6 +6,11 @@
 #include "exit.h"
 #include "jobs.h"
 #include "params.h"
+#include "parser.h"
+#include "profile.h"
+#include "runner.h"
+#include "stats.h"
+#include "util/alloc.h"
 #include "vars.h"
 
 /** cleans up and exits the shell
@@ -13,15 +18,19 @@
 void
 shell_exit(void) {
     /* Send SIGHUP (Hangup) signal to all jobs */
-    size_t job_count = jobs_get_joblist_size();
-    struct job const *jobs = jobs_get_joblist();
-    for (size_t i = 0; i < job_count; ++i) {
-        pid_t pgid = jobs[i].pgid;
-        kill(-pgid, SIGHUP);
+    for (struct job const *job = jobs_next(-1); job; job = jobs_next(job->jid)) {
+        pid_t pgid = job->pgid;
+        if (pgid) kill(-pgid, SIGHUP); /* Queued jobs are just dropped */
     }
 
+    stats_dump();
+    profile_dump();
+
     /* Call associated cleanup routines */
+    runner_cleanup();
     jobs_cleanup();
     vars_cleanup();
+    command_list_cleanup();
+    alloc_report_leaks();
     exit(params.status);
 }
@@ -10,7 +10,10 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "glob.h"
 #include "params.h"
+#include "probes.h"
+#include "util/alloc.h"
 #include "util/asprintf.h"
 #include "vars.h"
 
@@ -30,7 +33,7 @@ expand_substr(char **word, char **start, char **stop, char const *expansion) {
     size_t wlen = *start - *word + end - *stop;
     size_t elen = strlen(expansion);
 
-    char *w = malloc(wlen + elen + 1);
+    char *w = alloc_malloc(ALLOC_EXPAND, wlen + elen + 1);
     if (!w) goto out;
 
     memcpy(w, *word, *start - *word);
@@ -62,7 +65,7 @@ expand_tilde(char **word) {
         }
     } else {
         /* General case, ~<username>/... */
-        char *nam = strndup(w + 1, slash - w - 1);
+        char *nam = alloc_strndup(ALLOC_EXPAND, w + 1, slash - w - 1);
         puts(nam);
         if (!nam) err(1, 0);
         struct passwd *pw = getpwnam(nam);
@@ -149,14 +152,14 @@ expand_parameters(char **word) {
                 param = scan + 1;
                 for (; *scan && *scan != '}'; ++scan);
                 if (*scan != '}') return *word;
-                param = strndup(param, scan - param);
+                param = alloc_strndup(ALLOC_EXPAND, param, scan - param);
                 ++scan;
                 if (!param) err(1, 0);
             } else {
                 param = scan;
                 for (; *scan && (isalpha(*scan) || isdigit(*scan) || *scan == '_');
                        ++scan);
-                param = strndup(param, scan - param);
+                param = alloc_strndup(ALLOC_EXPAND, param, scan - param);
                 if (!param) err(1, 0);
             }
 
@@ -172,16 +175,26 @@ expand_parameters(char **word) {
     return w;
 }
 
+/** Removes quotes from a word
+ *
+ * @param [out]quoted  if not null pointer, gets a flag for each character
+ *                     left, set if it was quoted
+ */
 static char *
-remove_quotes(char **word) {
+remove_quotes(char **word, char *quoted) {
     char *in = *word;
     char *out = *word;
+    char dummy;
+    char *q = quoted ? quoted : &dummy;
+    size_t const step = quoted ? 1 : 0;
 
     for (; *in; *in && ++in) {
         if (*in == '\\') {
             ++in;
             if (in) {
                 *out++ = *in;
+                *q = 1;
+                q += step;
             }
             continue;
         }
@@ -189,9 +202,10 @@ remove_quotes(char **word) {
             ++in;
             for (; *in && *in != '\''; ++in) {
                 *out++ = *in;
+                *q = 1;
+                q += step;
             }
-            ++in;
-            continue;
+            continue; /* The loop steps over the closing quote */
         }
         if (*in == '"') {
             ++in;
@@ -200,21 +214,72 @@ remove_quotes(char **word) {
                     ++in;
                 }
                 *out++ = *in;
+                *q = 1;
+                q += step;
             }
-            ++in;
-            continue;
+            continue; /* The loop steps over the closing quote */
         }
         *out++ = *in;
+        *q = 0;
+        q += step;
     }
     *out = 0;
     return *word;
 }
 
+/** Expands a word, noting which characters of the result were quoted
+ *
+ * @param [out]quoted  see remove_quotes(); allocated here, to be freed
+ */
+static char *
+expand_marked(char **word, char **quoted) {
+    int64_t const start = PROBE_ENABLED(expand) ? probe_now() : 0;
+    if (!expand_tilde(word) || !expand_parameters(word)) return 0;
+    if (quoted) {
+        *quoted = alloc_malloc(ALLOC_EXPAND, strlen(*word) + 1);
+        if (!*quoted) return 0;
+    }
+    if (!remove_quotes(word, quoted ? *quoted : 0)) return 0;
+    PROBE2(expand, *word, start ? probe_now() - start : 0);
+    return *word;
+}
+
 char *
 expand(char **word) {
-    if (!expand_tilde(word) || !expand_parameters(word) || !remove_quotes(word))
-        return 0;
-    return *word;
+    return expand_marked(word, 0);
+}
+
+int
+expand_words(char ***words, size_t *count) {
+    for (size_t i = 0; i < *count; ++i) {
+        char *quoted = 0;
+        if (!expand_marked(&(*words)[i], &quoted)) {
+            free(quoted);
+            continue; /* Left as it is */
+        }
+        char **paths = 0;
+        ssize_t n = 0;
+        if (glob_is_pattern((*words)[i], quoted)) n = glob_expand((*words)[i], quoted, &paths);
+        free(quoted);
+        if (n < 0) return -1;
+        if (n == 0) continue; /* No match; the word stays */
+
+        /* Replace the word with its matches, keeping the terminating null */
+        void *tmp = alloc_realloc(ALLOC_EXPAND, *words, sizeof **words * (*count + (size_t) n));
+        if (!tmp) {
+            for (ssize_t k = 0; k < n; ++k) free(paths[k]);
+            free(paths);
+            return -1;
+        }
+        *words = tmp;
+        free((*words)[i]);
+        memmove(&(*words)[i + (size_t) n], &(*words)[i + 1], sizeof **words * (*count - i));
+        memcpy(&(*words)[i], paths, sizeof *paths * (size_t) n);
+        free(paths);
+        *count += (size_t) n - 1;
+        i += (size_t) n - 1;
+    }
+    return 0;
 }
 
 static char *
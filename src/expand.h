@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+
 /** tilde expansion, parameter expansion, and quote removal
  *
  * @param [in,out]word modified in place.
@@ -19,5 +21,18 @@
  */
 extern char *expand(char **word);
 
+/** Expands each word of a null-terminated list, as expand() does, with
+ *  pathname expansion between parameter expansion and quote removal
+ *
+ * A word matching files is replaced by their paths, so the list can grow;
+ * one matching nothing is kept. The list must have been allocated as with
+ * malloc(), and the words too.
+ *
+ * @param [in,out]words  the list
+ * @param [in,out]count  the number of words in it
+ * @returns 0 on success, -1 on failure
+ */
+extern int expand_words(char ***words, size_t *count);
+
 extern char *expand_prompt(char **word);
 
@@ -0,0 +1,481 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "glob.h"
+#include "util/alloc.h"
+
+/* A compiled path component */
+struct matcher {
+    struct token {
+        enum {
+            TOKEN_CHAR,  /* c */
+            TOKEN_ANY,   /* ? */
+            TOKEN_STAR,  /* * */
+            TOKEN_CLASS, /* [...] */
+        } kind;
+        unsigned char c;
+        uint8_t set[32]; /* TOKEN_CLASS: a bit per byte it matches */
+    } *tokens;
+    size_t count;
+    char *chars; /* Each token's c, so literal runs compare with memcmp() */
+
+    size_t prefix_len; /* Leading TOKEN_CHARs */
+    size_t suffix_len; /* TOKEN_CHARs after the last TOKEN_STAR */
+    int star;          /* Has a TOKEN_STAR */
+    int simple;        /* Just prefix, star, suffix; the fast paths decide alone */
+    int dot;           /* Starts with a literal '.', so may match hidden names */
+};
+
+/* A cached directory listing */
+struct listing {
+    char *path; /* As given; "" for the current directory */
+    dev_t dev;  /* Identify the directory, and its state when read */
+    ino_t ino;
+    struct timespec mtime;
+
+    struct entry {
+        char const *name;
+        unsigned char type; /* DT_* from getdents64(2) */
+    } *entries;
+    size_t count;   /* Sorted by name */
+    char *names;    /* One block for every name */
+};
+
+static struct listing *listings = 0;
+static size_t listing_count = 0;
+
+/* A growing list of paths */
+struct paths {
+    char **v;
+    size_t count;
+    size_t capacity;
+};
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static int
+by_name(void const *a, void const *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+int
+glob_is_pattern(char const *word, char const *quoted) {
+    for (size_t i = 0; word[i]; ++i) {
+        if (!quoted[i] && (word[i] == '*' || word[i] == '?' || word[i] == '[')) return 1;
+    }
+    return 0;
+}
+
+/** Parses a bracket expression, e.g. [a-z_], [!0-9] or [[:alpha:]]
+ *
+ * @returns its length, or 0 if there's no closing ']', in which case the '['
+ *          matches itself
+ */
+static size_t
+parse_class(struct token *t, char const *s, char const *q, size_t n) {
+    static struct {
+        char const *name;
+        int (*is)(int);
+    } const classes[] = {
+            {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank}, {"cntrl", iscntrl},
+            {"digit", isdigit}, {"graph", isgraph}, {"lower", islower}, {"print", isprint},
+            {"punct", ispunct}, {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit},
+    };
+
+    memset(t->set, 0, sizeof t->set);
+    size_t i = 1;
+    int negate = 0;
+    if (i < n && !q[i] && (s[i] == '!' || s[i] == '^')) {
+        negate = 1;
+        ++i;
+    }
+    size_t const first = i;
+    for (; i < n; ++i) {
+        if (!q[i] && s[i] == ']' && i > first) {
+            if (negate) {
+                for (size_t b = 0; b < sizeof t->set; ++b) t->set[b] = (uint8_t) ~t->set[b];
+            }
+            t->kind = TOKEN_CLASS;
+            return i + 1;
+        }
+        if (!q[i] && s[i] == '[' && i + 1 < n && s[i + 1] == ':') {
+            char const *end = memchr(s + i + 2, ':', n - i - 2);
+            if (!end || end + 1 >= s + n || end[1] != ']') return 0;
+            size_t const len = (size_t) (end - (s + i + 2));
+            size_t c = 0;
+            for (; c < sizeof classes / sizeof *classes; ++c) {
+                if (strlen(classes[c].name) == len && memcmp(classes[c].name, s + i + 2, len) == 0) break;
+            }
+            if (c == sizeof classes / sizeof *classes) return 0;
+            for (int b = 1; b < 256; ++b) {
+                if (classes[c].is(b)) t->set[b / 8] |= (uint8_t) (1u << (b % 8));
+            }
+            i = (size_t) (end + 1 - s);
+            continue;
+        }
+        unsigned char lo = (unsigned char) s[i];
+        unsigned char hi = lo;
+        if (i + 2 < n && !q[i + 1] && s[i + 1] == '-' && (q[i + 2] || s[i + 2] != ']')) {
+            hi = (unsigned char) s[i + 2];
+            i += 2;
+        }
+        for (unsigned b = lo; b <= hi; ++b) t->set[b / 8] |= (uint8_t) (1u << (b % 8));
+    }
+    return 0;
+}
+
+/** Compiles a path component
+ *
+ * @returns 1 if it has no pattern characters, 0 if it does, -1 on failure
+ */
+static int
+compile(struct matcher *m, char const *s, char const *q, size_t n) {
+    memset(m, 0, sizeof *m);
+    m->tokens = alloc_malloc(ALLOC_GLOB, sizeof *m->tokens * (n ? n : 1));
+    m->chars = alloc_malloc(ALLOC_GLOB, n ? n : 1);
+    if (!m->tokens || !m->chars) return -1;
+
+    int literal = 1;
+    for (size_t i = 0; i < n; ++i) {
+        struct token *t = &m->tokens[m->count];
+        size_t len = 0;
+        t->c = (unsigned char) s[i];
+        if (!q[i] && s[i] == '*') {
+            literal = 0;
+            m->star = 1;
+            if (m->count && m->tokens[m->count - 1].kind == TOKEN_STAR) continue;
+            t->kind = TOKEN_STAR;
+        } else if (!q[i] && s[i] == '?') {
+            literal = 0;
+            t->kind = TOKEN_ANY;
+        } else if (!q[i] && s[i] == '[' && (len = parse_class(t, s + i, q + i, n - i)) > 0) {
+            literal = 0;
+            i += len - 1;
+        } else {
+            t->kind = TOKEN_CHAR;
+        }
+        m->chars[m->count++] = (char) t->c;
+    }
+
+    while (m->prefix_len < m->count && m->tokens[m->prefix_len].kind == TOKEN_CHAR) ++m->prefix_len;
+    if (m->star) {
+        while (m->tokens[m->count - 1 - m->suffix_len].kind == TOKEN_CHAR) ++m->suffix_len;
+    }
+    m->simple = m->star && m->prefix_len + 1 + m->suffix_len == m->count;
+    m->dot = n && s[0] == '.';
+    return literal;
+}
+
+static void
+matcher_free(struct matcher *m) {
+    free(m->tokens);
+    free(m->chars);
+}
+
+static int
+token_matches(struct token const *t, unsigned char c) {
+    switch (t->kind) {
+        case TOKEN_CHAR:
+            return t->c == c;
+        case TOKEN_ANY:
+            return 1;
+        case TOKEN_CLASS:
+            return t->set[c / 8] >> (c % 8) & 1;
+        default:
+            return 0;
+    }
+}
+
+/** Checks if a name matches a compiled component */
+static int
+matches(struct matcher const *m, char const *name) {
+    if (name[0] == '.' && !m->dot) return 0;
+    size_t const len = strlen(name);
+
+    /* Most names are rejected here, without the full match */
+    if (m->star ? len < m->prefix_len + m->suffix_len : len != m->count) return 0;
+    if (memcmp(name, m->chars, m->prefix_len) != 0) return 0;
+    if (memcmp(name + len - m->suffix_len, m->chars + m->count - m->suffix_len, m->suffix_len) != 0) {
+        return 0;
+    }
+    if (m->simple) return 1;
+
+    /* What's left between the prefix and suffix, backtracking to the last star */
+    size_t const t_end = m->count - m->suffix_len;
+    size_t const n_end = len - m->suffix_len;
+    size_t t = m->prefix_len;
+    size_t p = m->prefix_len;
+    size_t star_t = SIZE_MAX;
+    size_t star_p = 0;
+    while (p < n_end) {
+        if (t < t_end && m->tokens[t].kind == TOKEN_STAR) {
+            star_t = ++t;
+            star_p = p;
+        } else if (t < t_end && token_matches(&m->tokens[t], (unsigned char) name[p])) {
+            ++t;
+            ++p;
+        } else if (star_t != SIZE_MAX) {
+            t = star_t;
+            p = ++star_p;
+        } else {
+            return 0;
+        }
+    }
+    while (t < t_end && m->tokens[t].kind == TOKEN_STAR) ++t;
+    return t == t_end;
+}
+
+static int
+by_entry_name(void const *a, void const *b) {
+    return strcmp(((struct entry const *) a)->name, ((struct entry const *) b)->name);
+}
+
+static void
+listing_free(struct listing *l) {
+    free(l->path);
+    free(l->entries);
+    free(l->names);
+}
+
+/** Reads a directory into a listing
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static int
+read_listing(struct listing *l, char const *path) {
+    memset(l, 0, sizeof *l);
+    size_t names_size = 0;
+    size_t names_capacity = 0;
+    size_t capacity = 0;
+    int fd = open(*path ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0) goto err;
+    l->dev = st.st_dev;
+    l->ino = st.st_ino;
+    l->mtime = st.st_mtim;
+    l->path = alloc_strdup(ALLOC_GLOB, path);
+    if (!l->path) goto err;
+
+    char buf[32768];
+    for (;;) {
+        long n = syscall(SYS_getdents64, fd, buf, sizeof buf);
+        if (n < 0) goto err;
+        if (n == 0) break;
+        for (long off = 0; off < n;) {
+            struct linux_dirent64 const *d = (void const *) (buf + off);
+            off += d->d_reclen;
+            char const *name = d->d_name;
+            if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]))) continue;
+
+            size_t const len = strlen(name) + 1;
+            if (names_size + len > names_capacity) {
+                names_capacity = names_capacity ? 2 * names_capacity : 4096;
+                if (names_capacity < names_size + len) names_capacity = names_size + len;
+                void *tmp = alloc_realloc(ALLOC_GLOB, l->names, names_capacity);
+                if (!tmp) goto err;
+                l->names = tmp;
+            }
+            if (l->count == capacity) {
+                capacity = capacity ? 2 * capacity : 64;
+                void *tmp = alloc_realloc(ALLOC_GLOB, l->entries, sizeof *l->entries * capacity);
+                if (!tmp) goto err;
+                l->entries = tmp;
+            }
+            memcpy(l->names + names_size, name, len);
+            /* Offsets until the names stop moving */
+            l->entries[l->count].name = (char const *) (uintptr_t) names_size;
+            l->entries[l->count].type = d->d_type;
+            ++l->count;
+            names_size += len;
+        }
+    }
+    close(fd);
+
+    for (size_t i = 0; i < l->count; ++i) {
+        l->entries[i].name = l->names + (uintptr_t) l->entries[i].name;
+    }
+    qsort(l->entries, l->count, sizeof *l->entries, by_entry_name);
+    return 0;
+
+    err:
+    close(fd);
+    listing_free(l);
+    return -1;
+}
+
+/** Gets a directory's listing, from the cache if it's unchanged
+ *
+ * @param path  a directory, or "" for the current one
+ * @returns null pointer if it can't be read
+ */
+static struct listing *
+get_listing(char const *path) {
+    struct stat st;
+    if (stat(*path ? path : ".", &st) < 0 || !S_ISDIR(st.st_mode)) return 0;
+
+    struct listing *l = 0;
+    for (size_t i = 0; i < listing_count; ++i) {
+        if (strcmp(listings[i].path, path) != 0) continue;
+        l = &listings[i];
+        if (l->dev == st.st_dev && l->ino == st.st_ino && l->mtime.tv_sec == st.st_mtim.tv_sec &&
+            l->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+            return l;
+        }
+        listing_free(l); /* Changed, or another directory after a cd */
+        break;
+    }
+    if (!l) {
+        void *tmp = alloc_realloc(ALLOC_GLOB, listings, sizeof *listings * (listing_count + 1));
+        if (!tmp) return 0;
+        listings = tmp;
+        l = &listings[listing_count++];
+    }
+    if (read_listing(l, path) < 0) {
+        *l = listings[--listing_count];
+        return 0;
+    }
+    return l;
+}
+
+void
+glob_cache_clear(void) {
+    for (size_t i = 0; i < listing_count; ++i) listing_free(&listings[i]);
+    free(listings);
+    listings = 0;
+    listing_count = 0;
+}
+
+/** Checks if a directory entry is a directory, or a link to one */
+static int
+is_dir(char const *dir, struct entry const *e) {
+    if (e->type == DT_DIR) return 1;
+    if (e->type != DT_UNKNOWN && e->type != DT_LNK) return 0;
+    size_t const dir_len = strlen(dir);
+    char *path = alloc_malloc(ALLOC_GLOB, dir_len + strlen(e->name) + 1);
+    if (!path) return 0;
+    memcpy(path, dir, dir_len);
+    strcpy(path + dir_len, e->name);
+    struct stat st;
+    int res = stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+    free(path);
+    return res;
+}
+
+/** Adds dir + name + (slash ? "/" : "") to a list
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static int
+add_path(struct paths *p, char const *dir, char const *name, size_t name_len, int slash) {
+    if (p->count == p->capacity) {
+        size_t const capacity = p->capacity ? 2 * p->capacity : 16;
+        void *tmp = alloc_realloc(ALLOC_GLOB, p->v, sizeof *p->v * capacity);
+        if (!tmp) return -1;
+        p->v = tmp;
+        p->capacity = capacity;
+    }
+    size_t const dir_len = strlen(dir);
+    char *path = alloc_malloc(ALLOC_GLOB, dir_len + name_len + 2);
+    if (!path) return -1;
+    memcpy(path, dir, dir_len);
+    memcpy(path + dir_len, name, name_len);
+    if (slash) path[dir_len + name_len++] = '/';
+    path[dir_len + name_len] = '\0';
+    p->v[p->count++] = path;
+    return 0;
+}
+
+static void
+paths_free(struct paths *p) {
+    for (size_t i = 0; i < p->count; ++i) free(p->v[i]);
+    free(p->v);
+    *p = (struct paths) {0};
+}
+
+ssize_t
+glob_expand(char const *word, char const *quoted, char ***paths) {
+    struct paths cur = {0};
+    struct paths next = {0};
+    struct matcher m = {0};
+    char *name = 0; /* A last component without pattern characters */
+    size_t const len = strlen(word);
+    size_t i = 0;
+    while (i < len && word[i] == '/') ++i;
+    if (add_path(&cur, "", "/", i ? 1 : 0, 0) < 0) goto err;
+
+    while (i < len && cur.count) {
+        size_t const end = i + strcspn(word + i, "/");
+        size_t next_i = end;
+        while (next_i < len && word[next_i] == '/') ++next_i;
+        int const last = next_i == len;
+        int const slash = !last || end < len; /* More to come, or a trailing slash */
+
+        int const literal = compile(&m, word + i, quoted + i, end - i);
+        if (literal < 0) goto err;
+        if (literal && last && !(name = alloc_strndup(ALLOC_GLOB, word + i, end - i))) goto err;
+        for (size_t d = 0; d < cur.count; ++d) {
+            char const *dir = cur.v[d];
+            if (literal && !last) {
+                /* Not checked; the next component's listing will be */
+                if (add_path(&next, dir, word + i, end - i, 1) < 0) goto err;
+                continue;
+            }
+            struct listing const *l = get_listing(dir);
+            if (!l) continue;
+            if (literal) {
+                struct entry const key = {.name = name};
+                struct entry const *e = bsearch(&key, l->entries, l->count, sizeof *l->entries, by_entry_name);
+                if (e && (!slash || is_dir(dir, e)) &&
+                    add_path(&next, dir, e->name, strlen(e->name), slash) < 0) {
+                    goto err;
+                }
+                continue;
+            }
+            for (size_t k = 0; k < l->count; ++k) {
+                struct entry const *e = &l->entries[k];
+                if (!matches(&m, e->name) || (slash && !is_dir(dir, e))) continue;
+                if (add_path(&next, dir, e->name, strlen(e->name), slash) < 0) goto err;
+            }
+        }
+        matcher_free(&m);
+        m = (struct matcher) {0};
+        free(name);
+        name = 0;
+        paths_free(&cur);
+        cur = next;
+        next = (struct paths) {0};
+        i = next_i;
+    }
+
+    if (!cur.count) {
+        paths_free(&cur);
+        *paths = 0;
+        return 0;
+    }
+    qsort(cur.v, cur.count, sizeof *cur.v, by_name);
+    *paths = cur.v;
+    return (ssize_t) cur.count;
+
+    err:
+    matcher_free(&m);
+    free(name);
+    paths_free(&cur);
+    paths_free(&next);
+    return -1;
+}
@@ -0,0 +1,41 @@
+#pragma once
+/** @file Pathname expansion
+ *
+ * Words with unquoted `*`, `?` or `[...]` are matched against the file
+ * system, one path component at a time. Each component is compiled once into
+ * a matcher, which rejects most names on its literal prefix and suffix before
+ * trying the full pattern.
+ *
+ * Directory listings are read with getdents64(2), sorted, and cached until
+ * glob_cache_clear(), so several patterns over one directory read it once; a
+ * listing is read again if the directory has changed since (e.g. an earlier
+ * command in the list created a file).
+ *
+ * As in other shells, names starting with '.' are only matched by a
+ * component starting with a literal '.', '.' and '..' are never matched, and
+ * a word matching nothing is left as it is.
+ */
+
+#include <sys/types.h>
+
+/** Checks if a word has unquoted pattern characters
+ *
+ * @param [in]word    the word, after quote removal
+ * @param [in]quoted  per character of word, nonzero if it was quoted
+ * @returns 1 if yes, 0 if not
+ */
+int glob_is_pattern(char const *word, char const *quoted);
+
+/** Finds the paths matching a pattern
+ *
+ * @param [in]word    the pattern, after quote removal
+ * @param [in]quoted  per character of word, nonzero if it was quoted, and
+ *                    so only matches itself
+ * @param [out]paths  the matching paths, sorted bytewise; the array and each
+ *                    path are to be freed
+ * @returns the number of paths, 0 if none match, or -1 on failure
+ */
+ssize_t glob_expand(char const *word, char const *quoted, char ***paths);
+
+/** Forgets the cached directory listings; done after each command list */
+void glob_cache_clear(void);
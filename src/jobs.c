@@ -1,93 +1,489 @@
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
 
 #include "jobs.h"
+#include "probes.h"
+#include "stats.h"
+#include "trace.h"
+#include "util/alloc.h"
+
+/* Jobs are stored by job id: slots[jid] is the job, or null. Which ids are in
+ * use is also kept in a bitmap, so the lowest free id is found a word at a
+ * time. Processes (group leaders included) are found through an
+ * open-addressing hash table from pid to job id. */
+
+static struct job **slots = 0;
+static size_t slot_count = 0;
+static size_t job_count = 0;
+static size_t active_count = 0; /* Jobs running or stopped */
+static size_t measured_count = 0; /* Jobs marked by jobs_set_measured() */
+
+/* Jobs with notify set, oldest first */
+static struct job *notify_first = 0;
+static struct job *notify_last = 0;
+
+static uint64_t *used = 0; /* One bit per slot */
+static size_t first_free_word = 0; /* No free ids below this word */
 
-struct job *jobs_joblist;
-size_t jobs_joblist_size = 0;
+static struct pid_entry {
+    pid_t pid; /* 0 marks an empty entry */
+    jid_t jid;
+} *pid_table = 0;
+static size_t pid_table_size = 0; /* Power of two */
+static size_t pid_count = 0;
+
+static size_t
+pid_hash(pid_t pid) {
+    return ((uint32_t) pid * 2654435769u) & (pid_table_size - 1);
+}
+
+static struct pid_entry *
+pid_find(pid_t pid) {
+    if (!pid_table_size || pid <= 0) return 0;
+    for (size_t i = pid_hash(pid);; i = (i + 1) & (pid_table_size - 1)) {
+        if (pid_table[i].pid == pid) return &pid_table[i];
+        if (pid_table[i].pid == 0) return 0;
+    }
+}
+
+static int pid_insert(pid_t pid, jid_t jid);
+
+/** Doubles the pid table, keeping its load under a half */
+static int
+pid_grow(void) {
+    struct pid_entry *old = pid_table;
+    size_t const old_size = pid_table_size;
+    size_t const new_size = old_size ? old_size * 2 : 64;
+    struct pid_entry *tmp = alloc_calloc(ALLOC_JOBS, new_size, sizeof *tmp);
+    if (!tmp) return -1;
+    pid_table = tmp;
+    pid_table_size = new_size;
+    pid_count = 0;
+    for (size_t i = 0; i < old_size; ++i) {
+        if (old[i].pid) pid_insert(old[i].pid, old[i].jid);
+    }
+    free(old);
+    return 0;
+}
+
+/** Maps a pid to a job; a reused pid is taken over by the newer job */
+static int
+pid_insert(pid_t pid, jid_t jid) {
+    struct pid_entry *e = pid_find(pid);
+    if (e) {
+        e->jid = jid;
+        return 0;
+    }
+    if (2 * (pid_count + 1) > pid_table_size && pid_grow() < 0) return -1;
+    size_t i = pid_hash(pid);
+    while (pid_table[i].pid) i = (i + 1) & (pid_table_size - 1);
+    pid_table[i] = (struct pid_entry) {.pid = pid, .jid = jid};
+    ++pid_count;
+    return 0;
+}
+
+/** Unmaps a pid, if it still belongs to the given job
+ *
+ * Uses backward-shift deletion, so lookups never need tombstones.
+ */
+static void
+pid_remove(pid_t pid, jid_t jid) {
+    struct pid_entry *e = pid_find(pid);
+    if (!e || e->jid != jid) return;
+    size_t const mask = pid_table_size - 1;
+    size_t hole = e - pid_table;
+    for (size_t i = (hole + 1) & mask; pid_table[i].pid; i = (i + 1) & mask) {
+        size_t home = pid_hash(pid_table[i].pid);
+        /* Move the entry back if the hole lies between its home and it */
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            pid_table[hole] = pid_table[i];
+            hole = i;
+        }
+    }
+    pid_table[hole].pid = 0;
+    --pid_count;
+}
+
+static struct job *
+find_job(jid_t jid) {
+    if (jid < 0 || (size_t) jid >= slot_count) return 0;
+    return slots[jid];
+}
+
+/** Finds the lowest unused job id, growing the table if all are taken */
+static jid_t
+alloc_jid(void) {
+    size_t const words = slot_count / 64;
+    for (size_t w = first_free_word; w < words; ++w) {
+        if (~used[w]) {
+            first_free_word = w;
+            return (jid_t) (w * 64 + __builtin_ctzll(~used[w]));
+        }
+    }
+
+    size_t const new_count = slot_count ? slot_count * 2 : 64;
+    void *tmp = alloc_realloc(ALLOC_JOBS, slots, sizeof *slots * new_count);
+    if (!tmp) return -1;
+    slots = tmp;
+    memset(&slots[slot_count], 0, sizeof *slots * (new_count - slot_count));
+    tmp = alloc_realloc(ALLOC_JOBS, used, sizeof *used * (new_count / 64));
+    if (!tmp) return -1;
+    used = tmp;
+    memset(&used[words], 0, sizeof *used * (new_count / 64 - words));
+    slot_count = new_count;
+    first_free_word = words;
+    return (jid_t) (words * 64);
+}
+
+static enum job_state
+job_state(struct job const *job) {
+    if (!job->pgid) return JOB_QUEUED;
+    int stopped = 0;
+    for (size_t i = 0; i < job->proc_count; ++i) {
+        if (job->procs[i].state == PROC_RUNNING) return JOB_RUNNING;
+        if (job->procs[i].state == PROC_STOPPED) stopped = 1;
+    }
+    return stopped ? JOB_STOPPED : JOB_DONE;
+}
+
+/** Sets a job's notification flag, queueing it to be reported on */
+static void
+notify_set(struct job *job) {
+    if (job->notify) return;
+    job->notify = 1;
+    job->notify_prev = notify_last;
+    job->notify_next = 0;
+    if (notify_last) notify_last->notify_next = job;
+    else notify_first = job;
+    notify_last = job;
+}
+
+/** Clears a job's notification flag, taking it off the queue */
+static void
+notify_clear(struct job *job) {
+    if (!job->notify) return;
+    job->notify = 0;
+    if (job->notify_prev) job->notify_prev->notify_next = job->notify_next;
+    else notify_first = job->notify_next;
+    if (job->notify_next) job->notify_next->notify_prev = job->notify_prev;
+    else notify_last = job->notify_prev;
+}
+
+/** Keeps the count of active jobs in step with a job's change of state */
+static void
+track(enum job_state before, enum job_state after) {
+    int const was = before == JOB_RUNNING || before == JOB_STOPPED;
+    int const is = after == JOB_RUNNING || after == JOB_STOPPED;
+    if (is && !was) ++active_count;
+    if (was && !is) --active_count;
+}
 
 struct job const *
-jobs_get_joblist(void) {
-    return jobs_joblist;
+jobs_next(jid_t after) {
+    size_t i = (size_t) (after + 1);
+    while (i < slot_count) {
+        uint64_t bits = used[i / 64] >> (i % 64);
+        if (bits) return slots[i + __builtin_ctzll(bits)];
+        i = (i / 64 + 1) * 64;
+    }
+    return 0;
 }
 
 size_t
-jobs_get_joblist_size(void) {
-    return jobs_joblist_size;
+jobs_count(void) {
+    return job_count;
+}
+
+size_t
+jobs_count_active(void) {
+    return active_count;
+}
+
+jid_t
+jobs_add_queued(void) {
+    jid_t jid = alloc_jid();
+    if (jid < 0) return -1;
+    struct job *job = alloc_malloc(ALLOC_JOBS, sizeof *job);
+    if (!job) return -1;
+    *job = (struct job) {.jid = jid};
+
+    slots[jid] = job;
+    used[jid / 64] |= UINT64_C(1) << (jid % 64);
+    ++job_count;
+    stats_max(STATS_PEAK_JOBS, job_count);
+    return jid;
+}
+
+int
+jobs_start(jid_t jid, pid_t pgid) {
+    struct job *job = find_job(jid);
+    if (!job || job->pgid || pgid <= 0 || jobs_get_jid(pgid) >= 0) return -1;
+    if (pid_insert(pgid, jid) < 0) return -1;
+    void *tmp = alloc_realloc(ALLOC_JOBS, job->procs, sizeof *job->procs * (job->proc_count + 1));
+    if (!tmp) {
+        pid_remove(pgid, jid);
+        return -1;
+    }
+    job->procs = tmp;
+    struct process *p = &job->procs[job->proc_count++];
+    *p = (struct process) {.pid = pgid, .state = PROC_RUNNING};
+    clock_gettime(CLOCK_MONOTONIC, &p->start);
+    job->pgid = pgid;
+    job->last_pid = pgid;
+    track(JOB_QUEUED, JOB_RUNNING);
+    PROBE2(job_add, jid, pgid);
+    trace_event(TRACE_JOB_ADD, (int32_t) jid, pgid, 0, 0);
+    return 0;
 }
 
 jid_t
 jobs_add(pid_t pgid) {
-    /* Allocate space for a new job record */
-    if (jobs_get_jid(pgid) >= 0) return -1;
-    void *tmp =
-            realloc(jobs_joblist, sizeof *jobs_joblist * (jobs_joblist_size + 1));
-    if (!tmp) return -1;
-    jobs_joblist = tmp;
-
-    /* Find lowest unused jobid */
-    jid_t jid = 0;
-    size_t insert_at = 0;
-    for (; insert_at < jobs_joblist_size; ++insert_at) {
-        if (jid < jobs_joblist[insert_at].jid) break;
-        jid = jobs_joblist[insert_at].jid + 1;
+    jid_t jid = jobs_add_queued();
+    if (jid < 0) return -1;
+    if (jobs_start(jid, pgid) < 0) {
+        jobs_remove(jid);
+        return -1;
     }
+    return jid;
+}
 
-    /* Keep the list sorted */
-    memmove(&jobs_joblist[insert_at + 1],
-            &jobs_joblist[insert_at],
-            sizeof *jobs_joblist * (jobs_joblist_size - insert_at));
+int
+jobs_add_process(jid_t jid, pid_t pid) {
+    struct job *job = find_job(jid);
+    if (!job) return -1;
+    void *tmp = alloc_realloc(ALLOC_JOBS, job->procs, sizeof *job->procs * (job->proc_count + 1));
+    if (!tmp) return -1;
+    job->procs = tmp;
+    if (pid_insert(pid, jid) < 0) return -1;
+    enum job_state before = job_state(job);
+    struct process *p = &job->procs[job->proc_count++];
+    *p = (struct process) {.pid = pid, .state = PROC_RUNNING};
+    clock_gettime(CLOCK_MONOTONIC, &p->start);
+    track(before, job_state(job));
+    return 0;
+}
 
-    /* Assign members to new entry */
-    jobs_joblist[insert_at] = (struct job) {.jid = jid, .pgid = pgid};
-    ++jobs_joblist_size;
-    return jid;
+int
+jobs_add_done(jid_t jid, char const *name, int status) {
+    struct job *job = find_job(jid);
+    if (!job) return -1;
+    void *tmp = alloc_realloc(ALLOC_JOBS, job->procs, sizeof *job->procs * (job->proc_count + 1));
+    if (!tmp) return -1;
+    job->procs = tmp;
+    /* No pid, so it's never in the pid table, nor signalled */
+    struct process *p = &job->procs[job->proc_count++];
+    *p = (struct process) {.status = status, .state = PROC_DONE};
+    snprintf(p->io.comm, sizeof p->io.comm, "%s", name);
+    clock_gettime(CLOCK_MONOTONIC, &p->start);
+    p->end = p->start;
+    return 0;
 }
 
-jid_t
-jobs_get_jid(pid_t pgid) {
-    for (size_t i = 0; i < jobs_joblist_size; ++i) {
-        if (jobs_joblist[i].pgid == pgid) return jobs_joblist[i].jid;
+int
+jobs_set_last(jid_t jid, pid_t pid) {
+    struct job *job = find_job(jid);
+    if (!job) return -1;
+    job->last_pid = pid;
+    return 0;
+}
+
+/** Finds a process by pid, for updating */
+static struct process *
+find_process(pid_t pid) {
+    struct pid_entry const *e = pid_find(pid);
+    struct job *job = e ? find_job(e->jid) : 0;
+    for (size_t i = 0; job && i < job->proc_count; ++i) {
+        if (job->procs[i].pid == pid) return &job->procs[i];
     }
-    return -1; /* DNE */
+    return 0;
 }
 
-pid_t
-jobs_get_gid(jid_t jid) {
-    for (size_t i = 0; i < jobs_joblist_size; ++i) {
-        if (jobs_joblist[i].jid == jid) return jobs_joblist[i].pgid;
+jid_t
+jobs_update(pid_t pid, int status, struct rusage const *usage) {
+    struct pid_entry const *e = pid_find(pid);
+    if (!e) return -1;
+    struct job *job = find_job(e->jid);
+    for (size_t j = 0; job && j < job->proc_count; ++j) {
+        struct process *p = &job->procs[j];
+        if (p->pid != pid) continue;
+
+        enum job_state before = job_state(job);
+        if (WIFSTOPPED(status)) {
+            p->state = PROC_STOPPED;
+        } else if (WIFCONTINUED(status)) {
+            p->state = PROC_RUNNING;
+        } else {
+            p->state = PROC_DONE;
+            p->status = status;
+            if (usage) p->usage = *usage;
+            clock_gettime(CLOCK_MONOTONIC, &p->end);
+        }
+        enum job_state after = job_state(job);
+        track(before, after);
+        if (after != before && after != JOB_RUNNING) notify_set(job);
+        return job->jid;
     }
     return -1;
 }
 
 int
-jobs_remove_gid(pid_t pgid) {
-    for (size_t i = 0; i < jobs_joblist_size;) {
-        if (jobs_joblist[i].pgid == pgid) {
-            memmove(&jobs_joblist[i],
-                    &jobs_joblist[i + 1],
-                    sizeof *jobs_joblist * (jobs_joblist_size - i - 1));
-            --jobs_joblist_size;
-
-            if (jobs_joblist_size) {
-                void *tmp =
-                        realloc(jobs_joblist, sizeof *jobs_joblist * (jobs_joblist_size));
-                if (!tmp) return -1;
-                jobs_joblist = tmp;
-            } else {
-                free(jobs_joblist);
-                jobs_joblist = 0;
-            }
+jobs_set_io(pid_t pid, struct proc_io const *io) {
+    struct process *p = find_process(pid);
+    if (!p) return -1;
+    p->io = *io;
+    return 0;
+}
+
+int
+jobs_continue(jid_t jid) {
+    struct job *job = find_job(jid);
+    if (!job) return -1;
+    for (size_t i = 0; i < job->proc_count; ++i) {
+        if (job->procs[i].state == PROC_STOPPED) job->procs[i].state = PROC_RUNNING;
+    }
+    notify_clear(job);
+    return 0;
+}
+
+int
+jobs_get_state(jid_t jid) {
+    struct job const *job = find_job(jid);
+    return job ? (int) job_state(job) : -1;
+}
+
+int
+jobs_get_status(jid_t jid, int *status) {
+    struct job const *job = find_job(jid);
+    if (!job) return -1;
+    for (size_t i = 0; i < job->proc_count; ++i) {
+        if (job->procs[i].pid == job->last_pid) {
+            *status = job->procs[i].status;
             return 0;
         }
-        if (++i == jobs_joblist_size) return -1;
     }
     return -1;
 }
 
+struct process const *
+jobs_get_process(pid_t pid, jid_t *jid) {
+    struct process const *p = find_process(pid);
+    if (p) *jid = pid_find(pid)->jid;
+    return p;
+}
+
+void
+jobs_set_timed_out(jid_t jid) {
+    struct job *job = find_job(jid);
+    if (job) job->timed_out = 1;
+}
+
+int
+jobs_timed_out(jid_t jid) {
+    struct job const *job = find_job(jid);
+    return job ? job->timed_out : 0;
+}
+
+void
+jobs_set_measured(jid_t jid, int format) {
+    struct job *job = find_job(jid);
+    if (!job) return;
+    if (!job->measured) ++measured_count;
+    job->measured = format;
+}
+
+int
+jobs_measured(jid_t jid) {
+    struct job const *job = find_job(jid);
+    return job ? job->measured : 0;
+}
+
+size_t
+jobs_count_measured(void) {
+    return measured_count;
+}
+
+struct job const *
+jobs_get(jid_t jid) {
+    return find_job(jid);
+}
+
+void
+jobs_clear_notify(jid_t jid) {
+    struct job *job = find_job(jid);
+    if (job) notify_clear(job);
+}
+
+jid_t
+jobs_first_notify(void) {
+    return notify_first ? notify_first->jid : -1;
+}
+
+jid_t
+jobs_get_jid(pid_t pgid) {
+    struct pid_entry const *e = pid_find(pgid);
+    if (!e) return -1;
+    struct job const *job = find_job(e->jid);
+    if (!job || job->pgid != pgid) return -1; /* Not a group leader */
+    return job->jid;
+}
+
+pid_t
+jobs_get_gid(jid_t jid) {
+    struct job const *job = find_job(jid);
+    return job && job->pgid ? job->pgid : -1;
+}
+
+int
+jobs_remove_gid(pid_t pgid) {
+    return jobs_remove(jobs_get_jid(pgid));
+}
+
+int
+jobs_remove(jid_t jid) {
+    struct job *job = find_job(jid);
+    if (!job) return -1;
+
+    int64_t lifetime = 0;
+    if (PROBE_ENABLED(job_remove) && job->proc_count) {
+        struct timespec const *s = &job->procs[0].start;
+        lifetime = probe_now() - ((int64_t) s->tv_sec * 1000000000 + s->tv_nsec);
+    }
+    PROBE3(job_remove, jid, job->pgid, lifetime);
+    trace_event(TRACE_JOB_REMOVE, (int32_t) jid, job->pgid, 0, 0);
+
+    track(job_state(job), JOB_DONE);
+    notify_clear(job);
+    if (job->measured) --measured_count;
+    for (size_t i = 0; i < job->proc_count; ++i) pid_remove(job->procs[i].pid, jid);
+    free(job->procs);
+    free(job);
+    slots[jid] = 0;
+    used[jid / 64] &= ~(UINT64_C(1) << (jid % 64));
+    if ((size_t) jid / 64 < first_free_word) first_free_word = jid / 64;
+    --job_count;
+    return 0;
+}
+
 void
 jobs_cleanup(void) {
-    free(jobs_joblist);
-    jobs_joblist = 0;
-    jobs_joblist_size = 0;
+    for (size_t i = 0; i < slot_count; ++i) {
+        if (slots[i]) {
+            free(slots[i]->procs);
+            free(slots[i]);
+        }
+    }
+    free(slots);
+    free(used);
+    free(pid_table);
+    slots = 0;
+    used = 0;
+    pid_table = 0;
+    notify_first = notify_last = 0;
+    slot_count = job_count = active_count = measured_count = first_free_word = 0;
+    pid_table_size = pid_count = 0;
 }
@@ -1,34 +1,212 @@
 #pragma once
 
+#include <stdint.h>
+#include <sys/resource.h>
 #include <sys/types.h>
+#include <time.h>
 
 /* Job id type */
 typedef long jid_t;
 
+/* A process belonging to a job */
+struct process {
+    pid_t pid;
+    int status; /* Last wait status reported for it */
+    enum proc_state {
+        PROC_RUNNING,
+        PROC_STOPPED,
+        PROC_DONE,
+    } state;
+
+    struct timespec start; /* When it was added, on CLOCK_MONOTONIC */
+    struct timespec end;   /* When it was reaped */
+    struct rusage usage;   /* From wait4(), once done; covers its own reaped children */
+    struct proc_io {
+        uint64_t rchar;       /* Bytes read, from anything (pipes included) */
+        uint64_t wchar;       /* Bytes written */
+        uint64_t read_bytes;  /* Of those, fetched from storage */
+        uint64_t write_bytes; /* Sent to storage */
+        char comm[16];        /* Command name */
+    } io; /* From /proc just before reaping; only for measured jobs */
+};
+
 struct job {
     jid_t jid;  /* Job id */
-    pid_t pgid; /* Process group id */
+    pid_t pgid; /* Process group id; 0 while queued */
+
+    struct process *procs;
+    size_t proc_count;
+    pid_t last_pid; /* Process whose status is the job's, i.e. the last stage */
+    int notify;     /* Stopped or finished since last reported */
+    int timed_out;  /* Signalled by its timeout (see timers.h) */
+    int measured;   /* How it's reported on when done, by the time keyword; 0 if not */
+
+    struct job *notify_prev, *notify_next; /* Other jobs with notify set */
 };
 
-/** Gets a list of all jobs
- *
- * Invalidated by a call to jobs_add or jobs_remove
- */
-extern struct job const *jobs_get_joblist(void);
+/* Overall state of a job */
+enum job_state {
+    JOB_RUNNING, /* Some process still running */
+    JOB_STOPPED, /* None running, some stopped */
+    JOB_DONE,    /* All finished */
+    JOB_QUEUED,  /* Not started yet; see jobs_add_queued() */
+};
 
-/** Gets the size of the job list
+/** Iterates over jobs in job id order
+ *
+ * @param [in]after job id to continue after, or -1 to start
+ * @returns the job with the lowest job id above `after`, or null pointer if
+ *          there are no more
+ *
+ *   for (struct job const *j = jobs_next(-1); j; j = jobs_next(j->jid))
  *
- * Invalidated by a call to jobs_add or jobs_remove
+ * A job may be removed while iterating, as long as it's done by job id:
+ * save j->jid before removing j.
  */
-extern size_t jobs_get_joblist_size(void);
+extern struct job const *jobs_next(jid_t after);
+
+/** Gets the number of jobs */
+extern size_t jobs_count(void);
+
+/** Gets the number of jobs running or stopped, i.e. neither queued nor done */
+extern size_t jobs_count_active(void);
 
 /** Add a process group to the jobs list
  *
  * @param [in]pgid the process group id to add to the job list
  * @returns the new job id, or -1 on failure
+ *
+ * The group leader, whose pid is pgid, is added as the job's first process.
  */
 extern jid_t jobs_add(pid_t pgid);
 
+/** Reserves a job id for a job that will be started later
+ *
+ * @returns the new job id, or -1 on failure
+ *
+ * The job is JOB_QUEUED, with no process group and no processes, until it's
+ * started with jobs_start().
+ */
+extern jid_t jobs_add_queued(void);
+
+/** Starts a queued job
+ *
+ * @param [in]pgid the process group the job now runs in
+ * @returns 0 on success, -1 on failure
+ *
+ * The group leader, whose pid is pgid, is added after any stages added with
+ * jobs_add_done().
+ */
+extern int jobs_start(jid_t jid, pid_t pgid);
+
+/** Adds a process to a job
+ *
+ * @returns 0 on success, -1 on failure
+ */
+extern int jobs_add_process(jid_t jid, pid_t pid);
+
+/** Adds a stage that already ran within the shell, e.g. a builtin
+ *
+ * @param [in]name   command name, reported as the process's
+ * @param [in]status its wait status
+ * @returns 0 on success, -1 on failure
+ *
+ * It's kept as a process that is done, without a pid. The job may still be
+ * queued, and is started with jobs_start() once its first child is.
+ */
+extern int jobs_add_done(jid_t jid, char const *name, int status);
+
+/** Sets the process whose exit status is the job's
+ *
+ * @returns 0 on success, -1 on failure
+ */
+extern int jobs_set_last(jid_t jid, pid_t pid);
+
+/** Records a wait status reported for a process
+ *
+ * @param [in]status status from wait4()
+ * @param [in]usage  resources it used, from wait4(); only kept once it's done
+ * @returns the job id of the process, or -1 if it's not part of a job
+ *
+ * Flags the job for notification when it becomes stopped or done.
+ */
+extern jid_t jobs_update(pid_t pid, int status, struct rusage const *usage);
+
+/** Records a process's I/O counters, read before it was reaped
+ *
+ * @returns 0 on success, -1 if it's not part of a job
+ */
+extern int jobs_set_io(pid_t pid, struct proc_io const *io);
+
+/** Marks a job's stopped processes as running, e.g. after sending SIGCONT
+ *
+ * @returns 0 on success, -1 on failure
+ */
+extern int jobs_continue(jid_t jid);
+
+/** Gets the overall state of a job
+ *
+ * @returns the state, or -1 if there is no such job
+ */
+extern int jobs_get_state(jid_t jid);
+
+/** Gets the wait status of a job's last process
+ *
+ * @returns 0 on success, -1 on failure
+ */
+extern int jobs_get_status(jid_t jid, int *status);
+
+/** Looks up a process by pid
+ *
+ * @param [out]jid the job the process belongs to
+ * @returns the process, or null pointer if it isn't part of a job
+ *
+ * Invalidated when processes are added to its job, or the job is removed.
+ */
+extern struct process const *jobs_get_process(pid_t pid, jid_t *jid);
+
+/** Marks a job as signalled by its timeout */
+extern void jobs_set_timed_out(jid_t jid);
+
+/** Checks if a job was signalled by its timeout */
+extern int jobs_timed_out(jid_t jid);
+
+/** Marks a job to be reported on when done
+ *
+ * @param format an enum timing_format (see timing.h)
+ */
+extern void jobs_set_measured(jid_t jid, int format);
+
+/** Checks how a job is to be reported on when done
+ *
+ * @returns its enum timing_format, or 0 if it isn't
+ */
+extern int jobs_measured(jid_t jid);
+
+/** Gets the number of jobs to be reported on, done or not */
+extern size_t jobs_count_measured(void);
+
+/** Looks up a job by job id
+ *
+ * @returns the job, or null pointer if there is no such job
+ *
+ * Invalidated as for jobs_get_process().
+ */
+extern struct job const *jobs_get(jid_t jid);
+
+/** Clears a job's notification flag */
+extern void jobs_clear_notify(jid_t jid);
+
+/** Finds the job flagged for notification longest ago
+ *
+ * @returns its job id, or -1 if none is flagged
+ *
+ * Flagged jobs are kept in a list of their own, so finding them doesn't
+ * look at the others. A job leaves it once its flag is cleared, or it's
+ * removed.
+ */
+extern jid_t jobs_first_notify(void);
+
 /** Removes a process group from the jobs list
  *
  * @param [in]pgid the process group id to remove from the job list
@@ -36,6 +214,12 @@ extern jid_t jobs_add(pid_t pgid);
  */
 extern int jobs_remove_gid(pid_t pgid);
 
+/** Removes a job, queued or not, from the jobs list
+ *
+ * @returns 0 on success, -1 on failure
+ */
+extern int jobs_remove(jid_t jid);
+
 /** Looks up a job's job id
  *
  * @param [in]pgid the process group id to look up
@@ -46,7 +230,8 @@ extern jid_t jobs_get_jid(pid_t pgid);
 /** Looks up a job's process group id
  *
  * @param [in]jobid the job id to look up
- * @returns The process group id on success, -1 on failure
+ * @returns The process group id on success, -1 on failure (including for
+ *          queued jobs, which have none yet)
  */
 extern pid_t jobs_get_gid(jid_t jobid);
 
@@ -6,21 +6,91 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "exit.h"
+#include "optimize.h"
 #include "params.h"
 #include "parser.h"
+#include "profile.h"
 #include "runner.h"
 #include "signal.h"
+#include "trace.h"
+#include "vars.h"
 #include "wait.h"
 
+/** Checks if all input has been consumed, without blocking
+ *
+ * Only memory streams (-c) and regular files are checked; terminals and
+ * pipes are assumed to have more to come.
+ */
+static int
+input_exhausted(FILE *input) {
+    struct stat st;
+    if (fileno(input) >= 0 && (fstat(fileno(input), &st) < 0 || !S_ISREG(st.st_mode))) return 0;
+    int c = getc(input);
+    if (c == EOF) return 1;
+    ungetc(c, input);
+    return 0;
+}
+
+static void
+usage(char const *name) {
+    fprintf(stderr,
+            "Usage: %s [--optimize] [--explain-optimizations] [-c string | file]\n",
+            name);
+    exit(2);
+}
+
 int
 main(int argc, char *argv[]) {
     struct command_list *cl = 0;
+    int optimize = 0;
+    FILE *explain = 0;
+    FILE *input = stdin;
+
+    /* Command line options */
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--optimize") == 0) {
+            optimize = 1;
+        } else if (strcmp(argv[i], "--explain-optimizations") == 0) {
+            optimize = 1;
+            explain = stderr;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            if (++i == argc) usage(argv[0]);
+            input = fmemopen(argv[i], strlen(argv[i]), "r");
+            if (!input) err(2, "-c");
+            break;
+        } else if (argv[i][0] != '-') {
+            input = fopen(argv[i], "r");
+            if (!input) err(127, "%s", argv[i]);
+            break;
+        } else {
+            usage(argv[0]);
+        }
+    }
 
     /* Program initialization routines */
+    char const *trace_path = vars_get("MS_TRACE");
+    if (trace_path && *trace_path && trace_open(trace_path) < 0) warn("MS_TRACE: %s", trace_path);
+    char const *profile = vars_get("MS_PROFILE");
+    if (profile && *profile && profile_open(profile) < 0) warn("MS_PROFILE: %s", profile);
+    errno = 0;
+
     if (signal_init() < 0) goto err;
 
+    if (wait_init() < 0) goto err;
+
+    /* Job control and prompts are only for terminals; decide once. Jobs
+     * run in process groups of their own either way, so whenever the shell
+     * has the terminal, it's handed to foreground jobs, lest they stop on
+     * reading from it and miss the Ctrl-C meant for them. */
+    params.terminal = isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == getpgrp();
+    params.interactive = input == stdin && params.terminal;
+    errno = 0;
+
     /* Main Event Loop: REPL -- Read Evaluate Print Loop */
     for (;;) {
         prompt:
@@ -29,13 +99,13 @@ main(int argc, char *argv[]) {
 
         /* Read input and parse it into a list of commands */
         if (signal_enable_interrupt(SIGINT) < 0) goto err;
-        int res = command_list_parse(&cl, stdin);
+        int res = command_list_parse(&cl, input);
         if (signal_ignore(SIGINT) < 0) goto err;
 
         if (res == -1) { /* System library errors */
             switch (errno) { /* Handle specific errors */
                 case EINTR:
-                    clearerr(stdin);
+                    clearerr(input);
                     errno = 0;
                     fputc('\n', stderr);
                     goto prompt;
@@ -47,11 +117,21 @@ main(int argc, char *argv[]) {
             errno = 0;
             goto prompt;
         } else if (res == 0) { /* No commands parsed */
-            if (feof(stdin)) shell_exit(); /* Exit on eof */
+            if (feof(input)) shell_exit(); /* Exit on eof */
             goto prompt; /* Blank line */
         } else {
-            /* Execute commands */
-            run_command_list(cl);
+            /* Rewrite pipelines into cheaper equivalents */
+            if (optimize) command_list_optimize(cl, explain);
+
+            /* Execute commands. The last one may replace the shell if
+             * nothing is left to read, unless it's to be profiled. */
+            int const flags = !profile_path && input_exhausted(input) ? RUN_TAIL_EXEC : 0;
+
+            /* Children share the input's file offset, and exit() syncs it
+             * back to their copy of the stream; drop our read-ahead first so
+             * that there is nothing for them to rewind */
+            fflush(input);
+            run_command_list(cl, flags);
 
             /* Cleanup */
             command_list_free(cl);
@@ -0,0 +1,244 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "optimize.h"
+#include "parser.h"
+#include "util/alloc.h"
+
+/** Checks if a word comes out of expansion unchanged
+ *
+ * Words are optimized before expansion, so only plain words can be reasoned
+ * about (e.g. checked for on the filesystem).
+ */
+static int
+is_literal(char const *word) {
+    return word[0] != '~' && !strpbrk(word, "$'\"\\*?[");
+}
+
+/** Checks if a redirection target is a file descriptor number */
+static int
+is_fd_target(struct io_redir const *r) {
+    if (r->io_op != OP_GREATAND && r->io_op != OP_LESSAND) return 0;
+    char *end = r->filename;
+    long fd = strtol(r->filename, &end, 10);
+    return *r->filename && !*end && fd >= 0 && fd <= INT_MAX;
+}
+
+/** Checks if a command is a plain `cat`, with no arguments or assignments */
+static int
+is_plain_cat(struct command const *cmd) {
+    return cmd->word_count >= 1 && strcmp(cmd->words[0], "cat") == 0 &&
+           cmd->assignment_count == 0 && cmd->fanout_count == 0 &&
+           cmd->workers == 0;
+}
+
+/** Checks if a command may redirect the shell's own files, as `exec >log`
+ *  does; a first word left to expansion might turn out to be exec */
+static int
+may_redirect_shell(struct command const *cmd) {
+    if (cmd->word_count == 0 || cmd->io_redir_count == 0) return 0;
+    return strcmp(cmd->words[0], "exec") == 0 || !is_literal(cmd->words[0]);
+}
+
+/** Checks if a command redirects its stdin */
+static int
+redirects_stdin(struct command const *cmd) {
+    for (size_t i = 0; i < cmd->io_redir_count; ++i) {
+        if (cmd->io_redirs[i]->io_number == STDIN_FILENO) return 1;
+    }
+    return 0;
+}
+
+/** Finds the file a leading `cat` stage reads, if it's safe to bypass
+ *
+ * @returns the file name, or null pointer if cat can't be bypassed
+ *
+ * Matches `cat FILE` and `<FILE cat`. The file has to be readable right now;
+ * otherwise cat would have reported the error and carried on with empty
+ * input, rather than the next stage failing its redirection.
+ */
+static char *
+cat_input_file(struct command const *cmd) {
+    char *file = 0;
+    if (!is_plain_cat(cmd)) return 0;
+    if (cmd->word_count == 2 && cmd->io_redir_count == 0) {
+        file = cmd->words[1];
+        if (file[0] == '-') return 0; /* Option, or stdin */
+    } else if (cmd->word_count == 1 && cmd->io_redir_count == 1) {
+        struct io_redir const *r = cmd->io_redirs[0];
+        if (r->io_number != STDIN_FILENO || r->io_op != OP_LESS) return 0;
+        file = r->filename;
+    } else {
+        return 0;
+    }
+    if (!is_literal(file) || access(file, R_OK) != 0) return 0;
+    return file;
+}
+
+/** Checks if a command is `cat` copying stdin to stdout */
+static int
+is_passthrough_cat(struct command const *cmd) {
+    if (!is_plain_cat(cmd) || cmd->io_redir_count != 0) return 0;
+    return cmd->word_count == 1 ||
+           (cmd->word_count == 2 && strcmp(cmd->words[1], "-") == 0);
+}
+
+static void
+remove_command(struct command_list *cl, size_t i) {
+    command_free(cl->commands[i]);
+    free(cl->commands[i]);
+    memmove(&cl->commands[i],
+            &cl->commands[i + 1],
+            sizeof *cl->commands * (cl->command_count - i - 1));
+    --cl->command_count;
+}
+
+static void
+remove_redirection(struct command *cmd, size_t i) {
+    free(cmd->io_redirs[i]->filename);
+    free(cmd->io_redirs[i]);
+    memmove(&cmd->io_redirs[i],
+            &cmd->io_redirs[i + 1],
+            sizeof *cmd->io_redirs * (cmd->io_redir_count - i - 1));
+    --cmd->io_redir_count;
+}
+
+/** Adds `<file` in front of a command's other redirections */
+static int
+prepend_input_redirection(struct command *cmd, char const *file) {
+    struct io_redir *r = alloc_malloc(ALLOC_PARSER, sizeof *r);
+    if (!r) return -1;
+    r->io_number = STDIN_FILENO;
+    r->io_op = OP_LESS;
+    r->filename = alloc_strdup(ALLOC_PARSER, file);
+    void *tmp = alloc_realloc(ALLOC_PARSER,
+                              cmd->io_redirs,
+                              sizeof *cmd->io_redirs * (cmd->io_redir_count + 1));
+    if (!r->filename || !tmp) {
+        free(r->filename);
+        free(r);
+        if (tmp) cmd->io_redirs = tmp;
+        return -1;
+    }
+    cmd->io_redirs = tmp;
+    memmove(&cmd->io_redirs[1],
+            &cmd->io_redirs[0],
+            sizeof *cmd->io_redirs * cmd->io_redir_count);
+    cmd->io_redirs[0] = r;
+    ++cmd->io_redir_count;
+    return 0;
+}
+
+/** Drops redirections that have no effect
+ *
+ * @returns number of redirections dropped
+ */
+static int
+merge_redirections(struct command *cmd, FILE *trace) {
+    int count = 0;
+    for (size_t i = 0; i + 1 < cmd->io_redir_count;) {
+        struct io_redir const *r = cmd->io_redirs[i];
+        struct io_redir const *next = cmd->io_redirs[i + 1];
+        int drop = 0;
+
+        if (is_fd_target(r) && is_fd_target(next) && r->io_number == next->io_number &&
+            strcmp(r->filename, next->filename) == 0) {
+            /* n>&m n>&m: the second is a no-op */
+            drop = 1;
+            ++i;
+        } else if (is_fd_target(r) && r->io_number == next->io_number &&
+                   strcmp(next->filename, r->filename) != 0) {
+            /* n>&m n>X: the dup is overwritten before anything sees it. Only
+             * safe if m was opened by an earlier redirection, and not closed
+             * since, since a bad m would otherwise fail the command. */
+            char *end;
+            long src = strtol(next->filename, &end, 10);
+            int reads_n = is_fd_target(next) && src == r->io_number;
+            src = strtol(r->filename, &end, 10);
+            int src_known = 0;
+            for (size_t j = 0; j < i; ++j) {
+                struct io_redir const *e = cmd->io_redirs[j];
+                if (e->io_number != src) continue;
+                int const closes = (e->io_op == OP_GREATAND || e->io_op == OP_LESSAND) &&
+                                   strcmp(e->filename, "-") == 0;
+                src_known = !closes;
+            }
+            drop = !reads_n && src_known;
+        }
+
+        if (drop) {
+            if (trace) {
+                fprintf(trace,
+                        "optimize: dropped redundant redirection %d>&%s\n",
+                        cmd->io_redirs[i]->io_number,
+                        cmd->io_redirs[i]->filename);
+            }
+            remove_redirection(cmd, i);
+            ++count;
+        } else {
+            ++i;
+        }
+    }
+    return count;
+}
+
+int
+command_list_optimize(struct command_list *cl, FILE *trace) {
+    int count = 0;
+    /* As of the start of the list; unknown once it may have been redirected */
+    int stdout_is_tty = isatty(STDOUT_FILENO);
+
+    for (size_t i = 0; i < cl->command_count;) {
+        struct command *cmd = cl->commands[i];
+        if (i > 0 && may_redirect_shell(cl->commands[i - 1])) stdout_is_tty = -1;
+        int const starts_pipeline = i == 0 || cl->commands[i - 1]->ctrl_op != '|';
+        struct command *next = i + 1 < cl->command_count ? cl->commands[i + 1] : 0;
+        struct command *prev = starts_pipeline ? 0 : cl->commands[i - 1];
+
+        for (size_t k = 0; k < cmd->fanout_count; ++k) {
+            int res = command_list_optimize(cmd->fanout[k], trace);
+            if (res < 0) return -1;
+            count += res;
+        }
+        count += merge_redirections(cmd, trace);
+
+        char *file = 0;
+        if (starts_pipeline && cmd->ctrl_op == '|' && next && !redirects_stdin(next) &&
+            (file = cat_input_file(cmd))) {
+            /* cat FILE | cmd  ->  cmd <FILE */
+            if (trace) {
+                fprintf(trace,
+                        "optimize: `cat %s | %s ...` -> `%s ... <%s`\n",
+                        file,
+                        next->word_count ? next->words[0] : "",
+                        next->word_count ? next->words[0] : "",
+                        file);
+            }
+            if (prepend_input_redirection(next, file) < 0) return -1;
+            remove_command(cl, i);
+            ++count;
+            continue;
+        }
+
+        if (prev && is_passthrough_cat(cmd) &&
+            (cmd->ctrl_op == '|' || stdout_is_tty == 0)) {
+            /* cmd | cat | cmd2  ->  cmd | cmd2, and cmd | cat  ->  cmd */
+            if (trace) {
+                fprintf(trace,
+                        "optimize: dropped `| cat` after `%s ...`\n",
+                        prev->word_count ? prev->words[0] : "");
+            }
+            prev->ctrl_op = cmd->ctrl_op;
+            remove_command(cl, i);
+            ++count;
+            continue;
+        }
+        ++i;
+    }
+    return count;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "parser.h"
+
+/** Rewrites pipelines into cheaper, equivalent forms
+ *
+ * @param [in,out]cl the parsed (unexpanded) command list
+ * @param [in]trace  stream to explain each rewrite on, or null
+ * @returns the number of rewrites made, or -1 on failure
+ *
+ * Rewrites:
+ *   cat FILE | cmd     ->  cmd <FILE      (leading cat of a readable file)
+ *   <FILE cat | cmd    ->  cmd <FILE
+ *   cmd | cat | cmd2   ->  cmd | cmd2     (cat copying stdin to stdout)
+ *   cmd | cat          ->  cmd            (only if stdout is not a tty, and
+ *                                          no exec before it may have made it one)
+ *   2>&1 2>&1          ->  2>&1           (repeated redirection)
+ *   >f 2>&1 2>g        ->  >f 2>g         (redirection overridden at once)
+ *
+ * Every stage removed saves a fork, an exec and a copy through a pipe.
+ */
+extern int command_list_optimize(struct command_list *cl, FILE *trace);
@@ -0,0 +1,515 @@
+#define _GNU_SOURCE
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "parallel.h"
+#include "parser.h"
+#include "spawn.h"
+#include "wait.h"
+
+/* Exit status for bad usage and internal failures */
+enum { PARALLEL_ERROR = 255 };
+
+/* Reads lines from a file descriptor into one growing buffer */
+struct line_reader {
+    int fd;
+    char *buf;
+    size_t start; /* Beginning of the unread data */
+    size_t len;   /* End of the data read */
+    size_t cap;
+    int eof;
+};
+
+/* A place for one running task */
+struct slot {
+    pid_t pid; /* 0 while free */
+    size_t seq;
+    struct timespec started;   /* CLOCK_REALTIME, for the joblog */
+    struct timespec started_m; /* CLOCK_MONOTONIC, for the runtime */
+    int out;                   /* -k: memory file collecting its stdout, or -1 */
+    char *cmdline;             /* --joblog: its command line */
+    size_t cmdline_cap;
+};
+
+/* Output of a task that finished ahead of its turn (-k) */
+struct held_output {
+    size_t seq;
+    int fd;
+};
+
+struct parallel {
+    size_t jobs;
+    int keep_order;
+    FILE *joblog;
+    enum { HALT_NEVER, HALT_SOON, HALT_NOW } halt;
+
+    char **template;
+    size_t template_count;
+    int has_placeholder;
+
+    /* Arguments following :::, or else read from stdin */
+    char **args;
+    size_t arg_count;
+    struct line_reader in;
+    int devnull;
+
+    /* The next task's words, rebuilt in place for every task */
+    char **words;
+    size_t words_cap;
+    char *text;
+    size_t text_cap;
+
+    struct slot *slots;
+    size_t running;
+    struct held_output *held;
+    size_t held_count;
+    size_t held_cap;
+    size_t next_seq;  /* Last sequence number handed out */
+    size_t next_emit; /* -k: sequence number whose output is due */
+
+    size_t failed;
+    int halting;
+    int halt_status;
+};
+
+/** Grows a buffer to hold at least `need` elements
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static int
+reserve(void *pbuf, size_t *cap, size_t need, size_t elem_size) {
+    if (need <= *cap) return 0;
+    size_t new_cap = *cap ? *cap : 64;
+    while (new_cap < need) new_cap *= 2;
+    void *tmp = realloc(*(void **) pbuf, new_cap * elem_size);
+    if (!tmp) return -1;
+    *(void **) pbuf = tmp;
+    *cap = new_cap;
+    return 0;
+}
+
+/** Reads the next line, without its newline
+ *
+ * @returns the line, valid until the next call; or null pointer at end of
+ *          input (errno 0) or on failure
+ */
+static char *
+read_line(struct line_reader *r) {
+    errno = 0;
+    for (;;) {
+        char *nl = memchr(r->buf + r->start, '\n', r->len - r->start);
+        if (nl) {
+            char *line = r->buf + r->start;
+            *nl = '\0';
+            r->start = nl + 1 - r->buf;
+            return line;
+        }
+        if (r->eof) {
+            if (r->start == r->len) return 0;
+            /* A last line without a newline; there is always room for the
+             * terminator, as the buffer is grown before it fills */
+            char *line = r->buf + r->start;
+            r->buf[r->len] = '\0';
+            r->start = r->len;
+            return line;
+        }
+
+        /* Keep the partial line, and make room for more */
+        memmove(r->buf, r->buf + r->start, r->len - r->start);
+        r->len -= r->start;
+        r->start = 0;
+        if (reserve(&r->buf, &r->cap, r->len + 4096 + 1, 1) < 0) return 0;
+
+        ssize_t n = read(r->fd, r->buf + r->len, r->cap - r->len - 1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        if (n == 0) r->eof = 1;
+        r->len += n;
+    }
+}
+
+/** Gets the next argument
+ *
+ * @returns the argument, or null pointer when there are no more (errno 0) or
+ *          on failure
+ */
+static char const *
+next_arg(struct parallel *p) {
+    if (p->args) {
+        errno = 0;
+        return p->next_seq < p->arg_count ? p->args[p->next_seq] : 0;
+    }
+    return read_line(&p->in);
+}
+
+/** Builds a task's words from the template and an argument
+ *
+ * @returns the number of words, or -1 on failure
+ *
+ * Words are laid out back to back in one reused buffer, so a task costs no
+ * allocations once the buffers are large enough.
+ */
+static ssize_t
+build_task(struct parallel *p, char const *arg) {
+    size_t const arg_len = strlen(arg);
+    size_t const count = p->template_count + !p->has_placeholder;
+
+    size_t size = p->has_placeholder ? 0 : arg_len + 1;
+    for (size_t i = 0; i < p->template_count; ++i) {
+        char const *w = p->template[i];
+        size += strlen(w) + 1;
+        while ((w = strstr(w, "{}"))) {
+            size += arg_len - 2;
+            w += 2;
+        }
+    }
+    if (reserve(&p->text, &p->text_cap, size, 1) < 0) return -1;
+    if (reserve(&p->words, &p->words_cap, count + 1, sizeof *p->words) < 0) return -1;
+
+    char *out = p->text;
+    for (size_t i = 0; i < p->template_count; ++i) {
+        p->words[i] = out;
+        char const *w = p->template[i];
+        char const *hole;
+        while ((hole = strstr(w, "{}"))) {
+            memcpy(out, w, hole - w);
+            out += hole - w;
+            memcpy(out, arg, arg_len);
+            out += arg_len;
+            w = hole + 2;
+        }
+        size_t const rest = strlen(w) + 1;
+        memcpy(out, w, rest);
+        out += rest;
+    }
+    if (!p->has_placeholder) {
+        p->words[p->template_count] = out;
+        memcpy(out, arg, arg_len + 1);
+    }
+    p->words[count] = 0;
+    return (ssize_t) count;
+}
+
+/** Records a task's command line in its slot, for the joblog
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static int
+save_cmdline(struct slot *slot, char **words, size_t count) {
+    size_t size = 1;
+    for (size_t i = 0; i < count; ++i) size += strlen(words[i]) + 1;
+    if (reserve(&slot->cmdline, &slot->cmdline_cap, size, 1) < 0) return -1;
+
+    char *out = slot->cmdline;
+    for (size_t i = 0; i < count; ++i) {
+        if (i) *out++ = ' ';
+        size_t const len = strlen(words[i]);
+        memcpy(out, words[i], len);
+        out += len;
+    }
+    *out = '\0';
+    return 0;
+}
+
+/** Starts a task in the caller's process group
+ *
+ * @returns the task's pid, or -1 on failure
+ */
+static pid_t
+start_task(char **words, size_t count, int stdin_fd, int stdout_fd) {
+    struct command task = {.words = words, .word_count = count};
+    pid_t pid = spawn_external(&task, stdin_fd, stdout_fd, getpgrp());
+    if (pid != 0) return pid;
+
+    /* Not found on PATH, most likely; let execvp() have the last word */
+    pid = fork();
+    if (pid == 0) {
+        if (stdin_fd >= 0 && dup2(stdin_fd, STDIN_FILENO) < 0) _exit(PARALLEL_ERROR);
+        if (stdout_fd >= 0 && dup2(stdout_fd, STDOUT_FILENO) < 0) _exit(PARALLEL_ERROR);
+        execvp(words[0], words);
+        int const status = errno == ENOENT ? 127 : 126;
+        warn("%s", words[0]);
+        _exit(status);
+    }
+    return pid;
+}
+
+/** Copies a task's buffered output to stdout
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static int
+copy_output(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) return -1;
+
+    off_t off = 0;
+    while (off < st.st_size) {
+        ssize_t n = sendfile(STDOUT_FILENO, fd, &off, st.st_size - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EINVAL || errno == ENOSYS)) break;
+        if (n <= 0) return -1;
+    }
+
+    /* Destinations sendfile() won't write to */
+    char buf[1 << 14];
+    while (off < st.st_size) {
+        ssize_t n = pread(fd, buf, sizeof buf, off);
+        if (n <= 0) return -1;
+        for (ssize_t done = 0; done < n;) {
+            ssize_t res = write(STDOUT_FILENO, buf + done, n - done);
+            if (res < 0 && errno == EINTR) continue;
+            if (res < 0) return -1;
+            done += res;
+        }
+        off += n;
+    }
+    return 0;
+}
+
+/** Writes out buffered output that is due, in argument order (-k)
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static int
+emit_ready(struct parallel *p) {
+    for (size_t i = 0; i < p->held_count;) {
+        if (p->held[i].seq != p->next_emit) {
+            ++i;
+            continue;
+        }
+        int const res = copy_output(p->held[i].fd);
+        close(p->held[i].fd);
+        p->held[i] = p->held[--p->held_count];
+        ++p->next_emit;
+        if (res < 0) return -1;
+        i = 0;
+    }
+    return 0;
+}
+
+/** Wraps up a task that has exited
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static int
+finish_task(struct parallel *p, struct slot *slot, int status) {
+    slot->pid = 0;
+    --p->running;
+
+    int const exit_status = wait_exit_status(status);
+    if (exit_status != 0) {
+        ++p->failed;
+        if (p->halt != HALT_NEVER && !p->halting) {
+            p->halting = 1;
+            p->halt_status = exit_status;
+            for (size_t i = 0; p->halt == HALT_NOW && i < p->jobs; ++i) {
+                if (p->slots[i].pid) kill(p->slots[i].pid, SIGTERM);
+            }
+        }
+    }
+
+    if (p->joblog) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double const runtime = (double) (now.tv_sec - slot->started_m.tv_sec) +
+                               (double) (now.tv_nsec - slot->started_m.tv_nsec) / 1e9;
+        fprintf(p->joblog,
+                "%zu\t%jd.%03ld\t%.3f\t%d\t%d\t%s\n",
+                slot->seq,
+                (intmax_t) slot->started.tv_sec,
+                slot->started.tv_nsec / 1000000,
+                runtime,
+                WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+                WIFSIGNALED(status) ? WTERMSIG(status) : 0,
+                slot->cmdline);
+    }
+
+    if (p->keep_order) {
+        if (reserve(&p->held, &p->held_cap, p->held_count + 1, sizeof *p->held) < 0) return -1;
+        p->held[p->held_count++] = (struct held_output) {.seq = slot->seq, .fd = slot->out};
+        slot->out = -1;
+        if (emit_ready(p) < 0) return -1;
+    }
+    return 0;
+}
+
+/** Parses the options ahead of the template
+ *
+ * @returns the index of the template's first word, or -1 on bad usage
+ */
+static ssize_t
+parse_options(struct parallel *p, char **argv, size_t argc) {
+    size_t i = 0;
+    for (; i < argc && argv[i][0] == '-'; ++i) {
+        char const *opt = argv[i];
+        if (strcmp(opt, "--") == 0) return (ssize_t) i + 1;
+
+        if (strcmp(opt, "-k") == 0 || strcmp(opt, "--keep-order") == 0) {
+            p->keep_order = 1;
+        } else if (strncmp(opt, "-j", 2) == 0 || strcmp(opt, "--jobs") == 0) {
+            char const *val = opt[1] == 'j' && opt[2] ? opt + 2 : (++i < argc ? argv[i] : 0);
+            char *end = 0;
+            long n = val ? strtol(val, &end, 10) : 0;
+            if (!val || *end || n <= 0) {
+                warnx("parallel: bad job count `%s'", val ? val : "");
+                return -1;
+            }
+            p->jobs = (size_t) n;
+        } else if (strcmp(opt, "--joblog") == 0 && i + 1 < argc) {
+            p->joblog = fopen(argv[++i], "a");
+            if (!p->joblog) {
+                warn("parallel: %s", argv[i]);
+                return -1;
+            }
+            setvbuf(p->joblog, 0, _IOLBF, 0);
+            fprintf(p->joblog, "Seq\tStarttime\tJobRuntime\tExitval\tSignal\tCommand\n");
+        } else if (strcmp(opt, "--halt") == 0 && i + 1 < argc) {
+            ++i;
+            if (strcmp(argv[i], "soon") == 0) {
+                p->halt = HALT_SOON;
+            } else if (strcmp(argv[i], "now") == 0) {
+                p->halt = HALT_NOW;
+            } else {
+                warnx("parallel: --halt takes `soon' or `now'");
+                return -1;
+            }
+        } else {
+            warnx("parallel: unknown option `%s'", opt);
+            return -1;
+        }
+    }
+    return (ssize_t) i;
+}
+
+int
+parallel_run(char **argv, size_t argc) {
+    struct parallel p = {
+            .in = {.fd = STDIN_FILENO},
+            .devnull = -1,
+            .next_emit = 1,
+    };
+    int result = PARALLEL_ERROR;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    p.jobs = cpus > 0 ? (size_t) cpus : 1;
+
+    ssize_t const first = parse_options(&p, argv, argc);
+    if (first < 0) goto out;
+    p.template = &argv[first];
+    while (first + p.template_count < argc && strcmp(p.template[p.template_count], ":::") != 0) {
+        ++p.template_count;
+    }
+    if (p.template_count == 0) {
+        warnx("usage: parallel [-j N] [-k] [--joblog FILE] [--halt soon|now] "
+              "cmd [args...] [::: arg...]");
+        goto out;
+    }
+    if (first + p.template_count < argc) {
+        p.args = &p.template[p.template_count + 1];
+        p.arg_count = argc - first - p.template_count - 1;
+    } else {
+        /* Tasks mustn't compete for the arguments */
+        p.devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (p.devnull < 0) goto err;
+    }
+    for (size_t i = 0; i < p.template_count; ++i) {
+        if (strstr(p.template[i], "{}")) p.has_placeholder = 1;
+    }
+
+    p.slots = calloc(p.jobs, sizeof *p.slots);
+    if (!p.slots) goto err;
+    for (size_t i = 0; i < p.jobs; ++i) p.slots[i].out = -1;
+
+    int exhausted = 0;
+    for (;;) {
+        /* Fill every free slot */
+        for (size_t i = 0; i < p.jobs && !exhausted && !p.halting; ++i) {
+            struct slot *slot = &p.slots[i];
+            if (slot->pid) continue;
+
+            char const *arg = next_arg(&p);
+            if (!arg) {
+                if (errno) goto err;
+                exhausted = 1;
+                break;
+            }
+            ssize_t const count = build_task(&p, arg);
+            if (count < 0) goto err;
+            if (p.joblog && save_cmdline(slot, p.words, (size_t) count) < 0) goto err;
+            if (p.keep_order && slot->out < 0) {
+                slot->out = memfd_create("parallel", MFD_CLOEXEC);
+                if (slot->out < 0) goto err;
+            }
+
+            slot->seq = ++p.next_seq;
+            clock_gettime(CLOCK_REALTIME, &slot->started);
+            clock_gettime(CLOCK_MONOTONIC, &slot->started_m);
+            slot->pid = start_task(p.words, (size_t) count, p.devnull, slot->out);
+            if (slot->pid < 0) {
+                slot->pid = 0;
+                goto err;
+            }
+            ++p.running;
+        }
+        if (p.running == 0) break;
+
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            goto err;
+        }
+        for (size_t i = 0; i < p.jobs; ++i) {
+            if (p.slots[i].pid == pid) {
+                if (finish_task(&p, &p.slots[i], status) < 0) goto err;
+                break;
+            }
+        }
+    }
+
+    if (p.halting) {
+        result = p.halt_status;
+    } else {
+        result = p.failed < 101 ? (int) p.failed : 101;
+    }
+    goto out;
+
+    err:
+    warn("parallel");
+    /* Don't leave tasks behind */
+    for (size_t i = 0; p.slots && i < p.jobs; ++i) {
+        if (p.slots[i].pid) kill(p.slots[i].pid, SIGTERM);
+    }
+    while (p.running && wait(0) > 0) --p.running;
+
+    out:
+    for (size_t i = 0; p.slots && i < p.jobs; ++i) {
+        if (p.slots[i].out >= 0) close(p.slots[i].out);
+        free(p.slots[i].cmdline);
+    }
+    for (size_t i = 0; i < p.held_count; ++i) close(p.held[i].fd);
+    if (p.joblog) fclose(p.joblog);
+    if (p.devnull >= 0) close(p.devnull);
+    free(p.slots);
+    free(p.held);
+    free(p.words);
+    free(p.text);
+    free(p.in.buf);
+    return result;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+
+/** Runs a command template once per argument, several at a time
+ *
+ * @param argv  options, template and arguments, after the builtin's name
+ * @param argc  number of entries in argv
+ * @returns the exit status: the number of failed tasks (at most 101), or
+ *          with --halt, the status of the task that failed; 255 on errors
+ *
+ * parallel [-j N] [-k] [--joblog FILE] [--halt soon|now] cmd [args...] [::: arg...]
+ *
+ * Each argument replaces every `{}` in the template, or is appended to it if
+ * there is none. Arguments follow `:::`, or are read from stdin one per
+ * line, in which case tasks get /dev/null as stdin.
+ *
+ *   -j N      run N tasks at once (default: the number of online CPUs)
+ *   -k        keep output in argument order, buffering each task's stdout
+ *   --joblog  append a line per task: sequence number, start time, runtime,
+ *             exit value, signal and command line
+ *   --halt    after a task fails, start no more; `now` also kills the rest
+ *
+ * Meant to run as the body of its own job (the caller's process group),
+ * which the tasks join: Ctrl-C, Ctrl-Z, fg and bg act on all of them at once.
+ * Tasks are handed out to slots as they free up, and per-task work reuses
+ * buffers, so millions of short tasks cost little beyond their spawns.
+ */
+extern int parallel_run(char **argv, size_t argc);
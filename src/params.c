@@ -3,4 +3,4 @@
 /* Definition for a struct holding the two special parameters we're using in our
  * shell: status ($?) and last bg pid ($!).
  */
-struct params params = {.status = 0, .bg_pid = 0};
+struct params params = {.status = 0, .bg_pid = 0, .interactive = 0, .terminal = 0};
@@ -5,9 +5,13 @@
 struct params {
     int status;
     pid_t bg_pid;
+    int interactive; /* reading commands from a terminal */
+    int terminal;    /* stdin is a terminal the shell is in the foreground of,
+                        which foreground jobs are handed, even from a script */
 };
 
 /* Declaration for a struct holding the two special parameters we're using in our
- * shell: status ($?) and last bg pid ($!).
+ * shell: status ($?) and last bg pid ($!), along with shell-wide state that is
+ * settled once at startup.
  */
 extern struct params params;
@@ -3,17 +3,30 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "expand.h"
+#include "params.h"
 #include "parser.h"
+#include "probes.h"
+#include "stats.h"
+#include "trace.h"
+#include "util/alloc.h"
 #include "vars.h"
+#include "wait.h"
 
+/* Nesting depth of fan-out groups `|{ ... }` being parsed */
+static int group_depth = 0;
 
-static void
+/* Parallel pipe operator awaiting the command it applies to */
+static unsigned pending_workers = 0;
+static int pending_ordered = 0;
+
+void
 command_free(struct command *cmd) {
     if (cmd) {
         for (size_t i = 0; i < cmd->assignment_count; ++i) {
@@ -33,11 +46,21 @@ command_free(struct command *cmd) {
             free(cmd->io_redirs[i]);
         }
         free(cmd->io_redirs);
+
+        for (size_t i = 0; i < cmd->fanout_count; ++i) {
+            command_list_free(cmd->fanout[i]);
+            free(cmd->fanout[i]);
+        }
+        free(cmd->fanout);
     }
 }
 
+/* The last list parsed, until it's freed */
+static struct command_list *parsed = 0;
+
 void
 command_list_free(struct command_list *cl) {
+    if (cl == parsed) parsed = 0;
     for (size_t i = 0; i < cl->command_count; ++i) {
         command_free(cl->commands[i]);
         free(cl->commands[i]);
@@ -45,6 +68,14 @@ command_list_free(struct command_list *cl) {
     free(cl->commands);
 }
 
+void
+command_list_cleanup(void) {
+    struct command_list *cl = parsed;
+    if (!cl) return;
+    command_list_free(cl);
+    free(cl);
+}
+
 char const *
 command_list_strerror(int e) {
     char const *emsg[] = {[0] = "match failure",
@@ -52,7 +83,9 @@ command_list_strerror(int e) {
             [2] = "unmatched `\"`",
             [3] = "unmatched `'`",
             [4] = "unterminated escape",
-            [5] = "unexpected symbol"};
+            [5] = "unexpected symbol",
+            [6] = "unmatched `{`",
+            [7] = "number out of range"};
     if (e > 0) {
         return "Success";
     } else {
@@ -83,6 +116,10 @@ redir_op_str(enum io_operator op) {
 
 void
 command_print(struct command const *cmd, FILE *stream) {
+    if (cmd->workers) {
+        fprintf(stream, "%c%u ", cmd->ordered ? '=' : '*', cmd->workers);
+    }
+
     for (size_t i = 0; i < cmd->assignment_count; ++i) {
         fprintf(stream,
                 "%s=%s ",
@@ -102,6 +139,15 @@ command_print(struct command const *cmd, FILE *stream) {
         fprintf(stream, " %s ", cmd->io_redirs[i]->filename);
     }
 
+    if (cmd->fanout_count) {
+        fputs("|{ ", stream);
+        for (size_t i = 0; i < cmd->fanout_count; ++i) {
+            command_list_print(cmd->fanout[i], stream);
+            fputc(' ', stream);
+        }
+        fputs("} ", stream);
+    }
+
     if (cmd->ctrl_op != '\n') {
         fputc(cmd->ctrl_op, stream);
     } else {
@@ -126,13 +172,18 @@ discard_whitespace(char const **s) {
     }
 }
 
+/** Matches a decimal number no greater than max
+ *
+ * @returns the number of digits matched, or -7 if the number is too large
+ */
 static int
-match_num(char const **s, int *out) {
+match_num(char const **s, int max, int *out) {
     char const *c = *s;
     *out = 0;
     for (; isdigit(*c); ++c) {
         int digval = *c - '0';
         assert(digval >= 0 && digval < 10);
+        if (*out > (max - digval) / 10) return -7;
         *out = *out * 10 + digval;
     }
     int retval = c - *s;
@@ -156,6 +207,7 @@ match_word(char const **s, char **out) {
     //          ;
     for (; !isblank(*c); ++c) {
         if (strchr("&;|<>\n", *c) != 0) break;
+        if (group_depth > 0 && *c == '}') break;
 
         if (*c == '"') {
             /* Double quotes */
@@ -196,7 +248,7 @@ match_word(char const **s, char **out) {
     if (c == word) goto match_fail;
 
     { /* Write output */
-        void *tmp = strndup(word, c - word);
+        void *tmp = alloc_strndup(ALLOC_PARSER, word, c - word);
         if (!tmp) {
             retval = -errno;
             goto err;
@@ -227,7 +279,7 @@ match_redirect(char const **s, struct io_redir **redir) {
     char *filename = 0;
 
     /* io_number */
-    retval = match_num(&c, &r.io_number);
+    retval = match_num(&c, INT_MAX, &r.io_number);
     if (retval < 0) goto err;
     if (retval == 0) { /* Assign a default io_number if match failed */
         if (*c == '>') r.io_number = 1;      /* stdout */
@@ -269,7 +321,7 @@ match_redirect(char const **s, struct io_redir **redir) {
     r.filename = filename;
 
     { /* Write output */
-        void *tmp = malloc(sizeof **redir);
+        void *tmp = alloc_malloc(ALLOC_PARSER, sizeof **redir);
         if (!tmp) {
             retval = -1;
             goto err;
@@ -300,7 +352,7 @@ match_assignment(char const **s, struct assignment **assn) {
     if (!isalpha(name[0]) && name[0] != '_') goto match_fail;
 
     for (; isalnum(*c) || *c == '_'; ++c);
-    a.name = strndup(name, c - name);
+    a.name = alloc_strndup(ALLOC_PARSER, name, c - name);
     if (!a.name) {
         retval = -1;
         goto err;
@@ -313,10 +365,10 @@ match_assignment(char const **s, struct assignment **assn) {
     /* Get value */
     retval = match_word(&c, &a.value);
     if (retval < 0) goto err;
-    if (retval == 0) a.value = strdup("");
+    if (retval == 0) a.value = alloc_strdup(ALLOC_PARSER, "");
 
     { /* Write output */
-        void *tmp = malloc(sizeof **assn);
+        void *tmp = alloc_malloc(ALLOC_PARSER, sizeof **assn);
         if (!tmp) {
             retval = -1;
             goto err;
@@ -338,7 +390,7 @@ match_assignment(char const **s, struct assignment **assn) {
 
 static int
 add_assignment(struct command *cmd, struct assignment *assn) {
-    void *tmp = realloc(cmd->assignments, sizeof *cmd->assignments * (cmd->assignment_count + 1));
+    void *tmp = alloc_realloc(ALLOC_PARSER, cmd->assignments, sizeof *cmd->assignments * (cmd->assignment_count + 1));
     if (!tmp) return -1;
     cmd->assignments = tmp;
     cmd->assignments[cmd->assignment_count++] = assn;
@@ -347,7 +399,7 @@ add_assignment(struct command *cmd, struct assignment *assn) {
 
 static int
 add_word(struct command *cmd, char *word) {
-    void *tmp = realloc(cmd->words, sizeof *cmd->words * (cmd->word_count + 1));
+    void *tmp = alloc_realloc(ALLOC_PARSER, cmd->words, sizeof *cmd->words * (cmd->word_count + 1));
     if (!tmp) return -1;
     cmd->words = tmp;
     cmd->words[cmd->word_count++] = word;
@@ -356,19 +408,127 @@ add_word(struct command *cmd, char *word) {
 
 static int
 add_redirection(struct command *cmd, struct io_redir *redir) {
-    void *tmp = realloc(cmd->io_redirs, sizeof *cmd->io_redirs * (cmd->io_redir_count + 1));
+    void *tmp = alloc_realloc(ALLOC_PARSER, cmd->io_redirs, sizeof *cmd->io_redirs * (cmd->io_redir_count + 1));
     if (!tmp) return -1;
     cmd->io_redirs = tmp;
     cmd->io_redirs[cmd->io_redir_count++] = redir;
     return 0;
 }
 
+static int match_command(char const **s, struct command **command);
+
+static int add_command(struct command_list *cl, struct command *cmd);
+
+static int
+add_branch(struct command *cmd, struct command_list *branch) {
+    void *tmp = alloc_realloc(ALLOC_PARSER, cmd->fanout, sizeof *cmd->fanout * (cmd->fanout_count + 1));
+    if (!tmp) return -1;
+    cmd->fanout = tmp;
+    cmd->fanout[cmd->fanout_count++] = branch;
+    return 0;
+}
+
+/** {[ \t]*pipeline([ \t]*;[ \t]*pipeline)*[ \t]*;?[ \t]*}[ \t]*[&;]?
+ *
+ * Matches the branches of a fan-out group following a '|' and attaches them
+ * to the producing command. On success, the producer's ctrl_op is replaced
+ * with the control operator following the group.
+ */
+static int
+match_fanout(char const **s, struct command *producer) {
+    int retval = 0;
+    char const *c = *s;
+    struct command_list *branch = 0;
+
+    assert(*c == '{');
+    ++c;
+    ++group_depth;
+    for (;;) {
+        discard_whitespace(&c);
+        if (*c == '}') break;
+        if (*c == '\n' || *c == '\0') {
+            retval = -6;
+            goto err;
+        }
+
+        if (!branch) {
+            branch = alloc_calloc(ALLOC_PARSER, 1, sizeof *branch);
+            if (!branch || add_branch(producer, branch) < 0) {
+                free(branch);
+                retval = -1;
+                goto err;
+            }
+        }
+
+        struct command *cmd = 0;
+        retval = match_command(&c, &cmd);
+        if (retval < 0) goto err;
+        if (retval == 0 || cmd->ctrl_op == '&') {
+            if (cmd) {
+                command_free(cmd);
+                free(cmd);
+            }
+            retval = -5; /* Branches can't be empty or run in background */
+            goto err;
+        }
+        if (add_command(branch, cmd) < 0) {
+            command_free(cmd);
+            free(cmd);
+            retval = -1;
+            goto err;
+        }
+        if (cmd->ctrl_op == ';') branch = 0; /* Start the next branch */
+    }
+    if (branch || producer->fanout_count == 0) {
+        retval = -5; /* Trailing '|' or empty group */
+        goto err;
+    }
+    ++c;
+    --group_depth;
+
+    /* Control operator following the group */
+    discard_whitespace(&c);
+    switch (*c) {
+        case '&':
+        case ';':
+            producer->ctrl_op = *c++;
+            break;
+        case '}':
+            if (group_depth == 0) {
+                retval = -5;
+                goto err;
+            }
+            producer->ctrl_op = ';';
+            break;
+        case '\n':
+        case '\0':
+            producer->ctrl_op = ';';
+            break;
+        default:
+            retval = -5;
+            goto err;
+    }
+
+    retval = c - *s;
+    *s = c;
+    if (0) {
+        err:;
+        /* Branches already attached are freed along with the producer */
+    }
+    return retval;
+}
+
 static int
 match_command(char const **s, struct command **command) {
     int retval = 0;
     struct command cmd = {0};
     char const *c = *s;
 
+    cmd.workers = pending_workers;
+    cmd.ordered = pending_ordered;
+    pending_workers = 0;
+    pending_ordered = 0;
+
     for (;;) {
         discard_whitespace(&c);
         if (cmd.word_count == 0) {
@@ -419,8 +579,34 @@ match_command(char const **s, struct command **command) {
     switch (*c) {
         case '&':
         case ';':
+            cmd.ctrl_op = *c++;
+            break;
         case '|':
             cmd.ctrl_op = *c++;
+            if (*c == '{') {
+                retval = match_fanout(&c, &cmd);
+                if (retval < 0) goto err;
+            } else if ((*c == '*' || *c == '=') && isdigit(c[1])) {
+                /* Parallel pipe operator: |*N or |=N */
+                int ordered = *c++ == '=';
+                int workers;
+                retval = match_num(&c, 1024, &workers);
+                if (retval < 0) goto err;
+                if (workers < 1) {
+                    retval = -5;
+                    goto err;
+                }
+                pending_workers = workers;
+                pending_ordered = ordered;
+            }
+            break;
+        case '}':
+            if (group_depth == 0) {
+                retval = -5;
+                goto err;
+            }
+            /* Closing brace is consumed by match_fanout() */
+            cmd.ctrl_op = ';';
             break;
         case '\n':
         case '\0':
@@ -436,7 +622,7 @@ match_command(char const **s, struct command **command) {
         --cmd.word_count;
     }
     { /* Write output */
-        void *tmp = malloc(sizeof **command);
+        void *tmp = alloc_malloc(ALLOC_PARSER, sizeof **command);
         if (!tmp) {
             retval = -1;
             goto err;
@@ -457,13 +643,16 @@ match_command(char const **s, struct command **command) {
 
 static int
 add_command(struct command_list *cl, struct command *cmd) {
-    void *tmp = realloc(cl->commands, sizeof *cl->commands * (cl->command_count + 1));
+    void *tmp = alloc_realloc(ALLOC_PARSER, cl->commands, sizeof *cl->commands * (cl->command_count + 1));
     if (!tmp) return -1;
     cl->commands = tmp;
     cl->commands[cl->command_count++] = cmd;
     return 0;
 }
 
+/* Lines read so far, for numbering command lists */
+static size_t lines_read = 0;
+
 int
 command_list_parse(struct command_list **cl, FILE *stream) {
     int count = 0;
@@ -473,7 +662,9 @@ command_list_parse(struct command_list **cl, FILE *stream) {
     char const *c;
     ssize_t line_length;
     struct command *cmd = 0;
-    void *tmp = malloc(sizeof **cl);
+    struct timespec const start = stats_begin();
+    PROBE0(parse_start);
+    void *tmp = alloc_malloc(ALLOC_PARSER, sizeof **cl);
     if (!tmp) {
         retval = -1;
         goto err;
@@ -481,8 +672,12 @@ command_list_parse(struct command_list **cl, FILE *stream) {
     *cl = tmp;
     (*cl)->command_count = 0;
     (*cl)->commands = 0;
+    (*cl)->line = lines_read + 1;
+    pending_workers = 0;
     do {
-        if (isatty(fileno(stream))) {
+        group_depth = 0;
+        uint64_t const read_start = trace_clock();
+        while (params.interactive) {
             char const *s = 0;
             if (!line) {
                 s = vars_get("PS1");
@@ -495,7 +690,7 @@ command_list_parse(struct command_list **cl, FILE *stream) {
                 if (!s) s = ">";
             }
             assert(s);
-            char *s_copy = strdup(s);
+            char *s_copy = alloc_strdup(ALLOC_PARSER, s);
             if (s_copy) {
                 if (expand_prompt(&s_copy)) {
                     char prefix[] = "\nMS: ";
@@ -504,21 +699,22 @@ command_list_parse(struct command_list **cl, FILE *stream) {
                 }
             }
             free(s_copy);
-        } else {
-            /* isatty() reports no-tty by setting errno to ENOTTY, so
-             * we need to ignore that and continue
-             *
-             * This is the case for a non-interactive terminal (e.g. script)
-             */
-            switch (errno) {
-                case ENOTTY:
-                    errno = 0;
-                    break;
-                default:
-                    goto err; /* EBADF, etc. */
+
+            /* Jobs finishing while we wait are reported right away, after
+             * which the prompt is shown again */
+            int res = wait_for_input(fileno(stream));
+            if (res < 0) {
+                retval = -1;
+                goto err;
             }
+            if (res == 0) break;
         }
         line_length = getline(&line, &n, stream);
+        if (line_length > 0) {
+            stats_add(STATS_BYTES_PARSED, (uint64_t) line_length);
+            ++lines_read;
+        }
+        trace_event(TRACE_LINE_READ, (int32_t) line_length, 0, trace_clock() - read_start, 0);
         if (line_length < 0) {
             if (feof(stream)) {
                 goto eof;
@@ -540,6 +736,7 @@ command_list_parse(struct command_list **cl, FILE *stream) {
         }
     } while (cmd->ctrl_op == '|');
     retval = count;
+    parsed = *cl;
     if (0) {
         err:
         match_fail:
@@ -549,5 +746,8 @@ command_list_parse(struct command_list **cl, FILE *stream) {
         *cl = 0;
     }
     free(line);
+    uint64_t const ns = stats_end(STATS_PARSE, start);
+    PROBE2(parse_done, retval, ns);
+    trace_event(TRACE_PARSE_DONE, retval, 0, ns, 0);
     return retval;
 }
@@ -46,9 +46,30 @@ struct command_list {
          * one of '&' (background), '|' (pipeline), or ';' (foreground)
          */
         char ctrl_op;
+
+        /* Fan-out branches reading copies of this command's stdout
+         * e.g. cmd |{ branch ; branch }
+         *
+         * Each branch is a pipeline. When present, ctrl_op holds the
+         * control operator following the closing brace.
+         */
+        struct command_list **fanout;
+        size_t fanout_count;
+
+        /* Number of copies of this command sharing its piped input, as set
+         * by the parallel pipe operators:
+         *   cmd |*N filter -- lines are dealt out to N filters in blocks
+         *   cmd |=N filter -- as above, with output kept in input order
+         * 0 for an ordinary command
+         */
+        unsigned workers;
+        int ordered;
     } **commands;
 
     size_t command_count;
+
+    /* Input line the list started on, counting from 1 */
+    size_t line;
 };
 
 /** Receives input and parses it into a command list */
@@ -61,6 +82,13 @@ char const *command_list_strerror(int e);
 /** Frees a parsed command list structure */
 void command_list_free(struct command_list *cl);
 
+/** Frees the last list parsed, if it hasn't been; for a shell exiting from
+ *  one of its commands */
+void command_list_cleanup(void);
+
+/** Frees the members of a parsed command, but not the command itself */
+void command_free(struct command *cmd);
+
 /** Prints a parsed command list */
 void command_list_print(struct command_list const *cl, FILE *stream);
 
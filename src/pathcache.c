@@ -0,0 +1,181 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pathcache.h"
+#include "stats.h"
+#include "util/phash.h"
+#include "vars.h"
+
+struct entry {
+    struct entry *next;
+    char *path;             /* null if the command wasn't found */
+    struct timespec expiry; /* when a miss is forgotten */
+    unsigned long hits;
+    char name[];
+};
+
+static struct entry **buckets = 0;
+static size_t bucket_count = 0;
+static size_t entry_count = 0;
+
+/** Searches $PATH for an executable, as execvp() would
+ *
+ * @returns the path (to be freed), or null pointer if not found
+ */
+static char *
+search_path(char const *name) {
+    char const *path = vars_get("PATH");
+    if (!path) path = "/bin:/usr/bin";
+    size_t const name_len = strlen(name);
+    for (char const *dir = path;;) {
+        char const *end = strchr(dir, ':');
+        size_t dir_len = end ? (size_t) (end - dir) : strlen(dir);
+        char *full = malloc(dir_len + name_len + 2);
+        if (!full) return 0;
+        if (dir_len == 0) {
+            strcpy(full, name); /* Empty entry: current directory */
+        } else {
+            memcpy(full, dir, dir_len);
+            full[dir_len] = '/';
+            strcpy(full + dir_len + 1, name);
+        }
+
+        struct stat st;
+        if (stat(full, &st) == 0 && S_ISREG(st.st_mode) && access(full, X_OK) == 0) return full;
+        free(full);
+        if (!end) return 0;
+        dir = end + 1;
+    }
+}
+
+static int
+expired(struct timespec const *expiry) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec > expiry->tv_sec ||
+           (now.tv_sec == expiry->tv_sec && now.tv_nsec >= expiry->tv_nsec);
+}
+
+/** Doubles the bucket array once entries outnumber buckets
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static int
+grow(void) {
+    size_t const new_count = bucket_count ? bucket_count * 2 : 64;
+    struct entry **new_buckets = calloc(new_count, sizeof *new_buckets);
+    if (!new_buckets) return -1;
+    for (size_t i = 0; i < bucket_count; ++i) {
+        while (buckets[i]) {
+            struct entry *e = buckets[i];
+            buckets[i] = e->next;
+            size_t b = phash(e->name, 0) & (new_count - 1);
+            e->next = new_buckets[b];
+            new_buckets[b] = e;
+        }
+    }
+    free(buckets);
+    buckets = new_buckets;
+    bucket_count = new_count;
+    return 0;
+}
+
+static struct entry **
+find(char const *name) {
+    if (!bucket_count) return 0;
+    struct entry **link = &buckets[phash(name, 0) & (bucket_count - 1)];
+    for (; *link; link = &(*link)->next) {
+        if (strcmp((*link)->name, name) == 0) return link;
+    }
+    return 0;
+}
+
+static void
+remove_entry(struct entry **link) {
+    struct entry *e = *link;
+    *link = e->next;
+    free(e->path);
+    free(e);
+    --entry_count;
+}
+
+char const *
+pathcache_lookup(char const *name) {
+    struct entry **link = find(name);
+    if (link) {
+        struct entry *e = *link;
+        if (e->path || !expired(&e->expiry)) {
+            ++e->hits;
+            stats_add(STATS_PATH_HITS, 1);
+            return e->path;
+        }
+        remove_entry(link); /* Stale miss; look again */
+    }
+
+    if (entry_count >= bucket_count && grow() < 0) return 0;
+
+    size_t const len = strlen(name);
+    struct entry *e = malloc(sizeof *e + len + 1);
+    if (!e) return 0;
+    memcpy(e->name, name, len + 1);
+    e->path = search_path(name);
+    stats_add(STATS_PATH_MISSES, 1);
+    e->hits = 1;
+    if (!e->path) {
+        clock_gettime(CLOCK_MONOTONIC, &e->expiry);
+        e->expiry.tv_sec += PATHCACHE_MISS_TTL_MS / 1000;
+        e->expiry.tv_nsec += (PATHCACHE_MISS_TTL_MS % 1000) * 1000000L;
+        if (e->expiry.tv_nsec >= 1000000000L) {
+            e->expiry.tv_nsec -= 1000000000L;
+            ++e->expiry.tv_sec;
+        }
+    }
+    size_t b = phash(name, 0) & (bucket_count - 1);
+    e->next = buckets[b];
+    buckets[b] = e;
+    ++entry_count;
+    return e->path;
+}
+
+void
+pathcache_forget(char const *name) {
+    struct entry **link = find(name);
+    if (link) remove_entry(link);
+}
+
+void
+pathcache_clear(void) {
+    for (size_t i = 0; i < bucket_count; ++i) {
+        while (buckets[i]) remove_entry(&buckets[i]);
+    }
+}
+
+void
+pathcache_chdir(void) {
+    char const *path = vars_get("PATH");
+    if (!path) return; /* The default has none */
+    for (char const *dir = path;;) {
+        if (*dir != '/') {
+            pathcache_clear();
+            return;
+        }
+        dir = strchr(dir, ':');
+        if (!dir++) return;
+    }
+}
+
+void
+pathcache_print(int fd) {
+    for (size_t i = 0; i < bucket_count; ++i) {
+        for (struct entry const *e = buckets[i]; e; e = e->next) {
+            if (e->path) dprintf(fd, "%lu\t%s\n", e->hits, e->path);
+        }
+    }
+}
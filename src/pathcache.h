@@ -0,0 +1,44 @@
+#pragma once
+/** @file Command path cache
+ *
+ * Remembers where on $PATH each command was found, so that commands are
+ * located with one hash lookup rather than a failed execve() per directory.
+ * Commands that weren't found are remembered too, for PATHCACHE_MISS_TTL_MS,
+ * so a script probing for a missing command doesn't rescan $PATH every time.
+ *
+ * The cache is cleared whenever PATH is set or unset, and on cd if $PATH has
+ * relative entries, such as "." or an empty one.
+ */
+
+/* How long a failed lookup is remembered */
+enum { PATHCACHE_MISS_TTL_MS = 2000 };
+
+/** Finds a command on $PATH
+ *
+ * @param [in]name command name, without any '/'
+ * @returns the command's path, or null pointer if not found (or out of
+ *          memory). The path belongs to the cache, and is only valid until the
+ *          next call into it.
+ */
+char const *pathcache_lookup(char const *name);
+
+/** Forgets a command, e.g. because its cached path no longer exists */
+void pathcache_forget(char const *name);
+
+/** Forgets all commands */
+void pathcache_clear(void);
+
+/** Forgets all commands if where they are found depends on the working
+ *  directory, for when it changes
+ *
+ * With a relative entry on $PATH, any lookup may come out differently: a
+ * command found through it may be gone, and one found further on, or not at
+ * all, may now be shadowed by it.
+ */
+void pathcache_chdir(void);
+
+/** Lists the cached commands found on $PATH
+ *
+ * "hits<TAB>path" per line, as `hash` does in other shells.
+ */
+void pathcache_print(int fd);
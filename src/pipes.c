@@ -0,0 +1,132 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pipes.h"
+#include "vars.h"
+
+/* Writers whose stdout pipes are watched in adaptive mode */
+static struct watched_pipe {
+    pid_t writer;
+    dev_t dev; /* The pipe the shell made for it */
+    ino_t ino;
+} *watched = 0;
+static size_t watched_count = 0;
+
+/** Largest pipe an unprivileged process may ask for */
+static long
+max_size(void) {
+    static long max = 0;
+    if (max == 0) {
+        FILE *f = fopen("/proc/sys/fs/pipe-max-size", "r");
+        if (!f || fscanf(f, "%ld", &max) != 1) max = 1024 * 1024;
+        if (f) fclose(f);
+    }
+    return max;
+}
+
+/** Parses $MS_PIPE_SIZE
+ *
+ * @returns requested size in bytes, or 0 for the system default, also given
+ *          for sizes above max_size()
+ */
+static long
+requested_size(void) {
+    char const *s = vars_get("MS_PIPE_SIZE");
+    if (!s || !*s) return 0;
+
+    char *end = 0;
+    long size = strtol(s, &end, 10);
+    long unit = 1;
+    switch (tolower(*end)) {
+        case 'k':
+            unit = 1024;
+            ++end;
+            break;
+        case 'm':
+            unit = 1024 * 1024;
+            ++end;
+            break;
+    }
+    /* Checked before multiplying, which could overflow */
+    if (*end || size <= 0 || size > max_size() / unit) return 0;
+    return size * unit;
+}
+
+int
+pipe_adaptive(void) {
+    char const *s = vars_get("MS_PIPE_SIZE");
+    return s && strcmp(s, "auto") == 0;
+}
+
+int
+pipe_open(int fds[2]) {
+    if (pipe2(fds, O_CLOEXEC) == -1) return -1;
+    long const size = requested_size();
+    if (size > 0) fcntl(fds[1], F_SETPIPE_SZ, (int) size);
+    return 0;
+}
+
+int
+pipe_watch(pid_t writer, struct stat const *pipe) {
+    void *tmp = realloc(watched, sizeof *watched * (watched_count + 1));
+    if (!tmp) return -1;
+    watched = tmp;
+    watched[watched_count++] = (struct watched_pipe) {
+            .writer = writer,
+            .dev = pipe->st_dev,
+            .ino = pipe->st_ino,
+    };
+    return 0;
+}
+
+/** Checks if a file is the pipe the shell made for a writer */
+static int
+is_watched_pipe(struct stat const *st, struct watched_pipe const *w) {
+    return S_ISFIFO(st->st_mode) && st->st_dev == w->dev && st->st_ino == w->ino;
+}
+
+void
+pipe_watch_reset(void) {
+    free(watched);
+    watched = 0;
+    watched_count = 0;
+}
+
+int
+pipe_adapt(void) {
+    int grown = 0;
+    for (size_t i = 0; i < watched_count; ++i) {
+        /* The shell closed its ends of the pipe long ago, but it can be
+         * reopened through the writer's fd table. Taking a write end is
+         * harmless while the writer itself still holds one. The writer may
+         * have redirected its stdout since, maybe to some other FIFO, so
+         * only the shell's own pipe is opened and resized. */
+        char path[64];
+        snprintf(path, sizeof path, "/proc/%jd/fd/1", (intmax_t) watched[i].writer);
+        struct stat st;
+        if (stat(path, &st) < 0 || !is_watched_pipe(&st, &watched[i])) continue;
+        int fd = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0) continue; /* Writer is gone */
+
+        int queued = 0;
+        int size = 0;
+        if (fstat(fd, &st) == 0 && is_watched_pipe(&st, &watched[i]) &&
+            ioctl(fd, FIONREAD, &queued) == 0 &&
+            (size = fcntl(fd, F_GETPIPE_SZ)) > 0 && queued >= size && size < max_size()) {
+            long target = 2L * size;
+            if (target > max_size()) target = max_size();
+            if (fcntl(fd, F_SETPIPE_SZ, (int) target) > 0) ++grown;
+        }
+        close(fd);
+    }
+    return grown;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/** Creates a close-on-exec pipe sized according to $MS_PIPE_SIZE
+ *
+ * @param [out]fds read and write ends, as with pipe()
+ * @returns 0 on success, -1 on failure
+ *
+ * MS_PIPE_SIZE is a byte count, optionally suffixed with k or m, or `auto`.
+ * Unset or invalid values, and sizes above /proc/sys/fs/pipe-max-size, leave
+ * the system default (usually 64 KiB). Sizing is best effort: a size the
+ * system refuses is not an error.
+ */
+extern int pipe_open(int fds[2]);
+
+/** Checks if pipes are sized adaptively (MS_PIPE_SIZE=auto) */
+extern int pipe_adaptive(void);
+
+/** Watches the pipe a pipeline stage writes its stdout to
+ *
+ * @param [in]writer pid of the stage
+ * @param [in]pipe   the pipe, as fstat() gave it for the shell's end; only
+ *                   that pipe is resized, whatever the stage's stdout is by
+ *                   then
+ * @returns 0 on success, -1 on failure
+ */
+extern int pipe_watch(pid_t writer, struct stat const *pipe);
+
+/** Stops watching all pipes */
+extern void pipe_watch_reset(void);
+
+/** Grows watched pipes that are full
+ *
+ * A full pipe means its writer is stalled waiting on the reader. Such pipes
+ * are doubled in size, up to the system limit, to let the writer run ahead
+ * further between wakeups.
+ *
+ * @returns number of pipes grown
+ */
+extern int pipe_adapt(void);
@@ -0,0 +1,205 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "placement.h"
+#include "vars.h"
+
+/* ioprio_set(2) has no glibc wrapper */
+enum {
+    IOPRIO_WHO_PROCESS = 1,
+    IOPRIO_CLASS_SHIFT = 13,
+};
+
+/* MS_CPUS=auto: the shell's CPUs, neighbours in the cache hierarchy next to
+ * each other, and where the next pipeline starts */
+static int *auto_order = 0;
+static size_t auto_count = 0;
+static size_t auto_next = 0;
+
+int
+placement_parse_cpus(char const *s, cpu_set_t *set) {
+    CPU_ZERO(set);
+    while (*s) {
+        char *end = 0;
+        long lo = strtol(s, &end, 10);
+        if (end == s || lo < 0) return -1;
+        long hi = lo;
+        if (*end == '-') {
+            s = end + 1;
+            hi = strtol(s, &end, 10);
+            if (end == s || hi < lo) return -1;
+        }
+        if (hi >= CPU_SETSIZE) return -1;
+        for (long cpu = lo; cpu <= hi; ++cpu) CPU_SET(cpu, set);
+        s = end;
+        if (*s == ',') ++s;
+        else if (*s) return -1;
+    }
+    return CPU_COUNT(set) ? 0 : -1;
+}
+
+int
+placement_parse_ionice(char const *class, char const *level, int *ioprio) {
+    static char const *const names[] = {"none", "rt", "be", "idle"};
+    long c = -1;
+    for (size_t i = 1; i < sizeof names / sizeof *names; ++i) {
+        if (strcmp(class, names[i]) == 0) c = (long) i;
+    }
+    if (c < 0) {
+        char *end = 0;
+        c = strtol(class, &end, 10);
+        if (!*class || *end || c < 1 || c > 3) return -1;
+    }
+
+    long l = 4; /* The kernel's default for be */
+    if (c == 3) l = 0; /* Idle has no levels */
+    if (level) {
+        char *end = 0;
+        l = strtol(level, &end, 10);
+        if (!*level || *end || l < 0 || l > 7) return -1;
+    }
+    *ioprio = (int) (c << IOPRIO_CLASS_SHIFT | l);
+    return 0;
+}
+
+int
+placement_parse_ioprio(char const *s, int *ioprio) {
+    char class[16];
+    char const *colon = strchr(s, ':');
+    size_t const len = colon ? (size_t) (colon - s) : strlen(s);
+    if (len >= sizeof class) return -1;
+    memcpy(class, s, len);
+    class[len] = '\0';
+    return placement_parse_ionice(class, colon ? colon + 1 : 0, ioprio);
+}
+
+/** Reads a CPU's topology attribute, e.g. core_id
+ *
+ * @returns its value, or -1 if unknown
+ */
+static long
+topology(int cpu, char const *attr) {
+    char path[96];
+    snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, attr);
+    FILE *f = fopen(path, "r");
+    long val = -1;
+    if (f) {
+        if (fscanf(f, "%ld", &val) != 1) val = -1;
+        fclose(f);
+    }
+    return val;
+}
+
+/* Sort key for auto placement: package, then core, then CPU number */
+struct cpu_key {
+    long package;
+    long core;
+    int cpu;
+};
+
+static int
+cpu_key_cmp(void const *a, void const *b) {
+    struct cpu_key const *x = a;
+    struct cpu_key const *y = b;
+    if (x->package != y->package) return x->package < y->package ? -1 : 1;
+    if (x->core != y->core) return x->core < y->core ? -1 : 1;
+    return (x->cpu > y->cpu) - (x->cpu < y->cpu);
+}
+
+/** Works out the CPU order for auto placement, once
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static int
+auto_init(void) {
+    if (auto_order) return 0;
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof allowed, &allowed) < 0) return -1;
+
+    size_t const n = (size_t) CPU_COUNT(&allowed);
+    struct cpu_key *keys = malloc(sizeof *keys * n);
+    auto_order = malloc(sizeof *auto_order * n);
+    if (!keys || !auto_order) {
+        free(keys);
+        free(auto_order);
+        auto_order = 0;
+        return -1;
+    }
+    size_t k = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && k < n; ++cpu) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        keys[k++] = (struct cpu_key) {
+                .package = topology(cpu, "physical_package_id"),
+                .core = topology(cpu, "core_id"),
+                .cpu = cpu,
+        };
+    }
+    qsort(keys, k, sizeof *keys, cpu_key_cmp);
+    for (size_t i = 0; i < k; ++i) auto_order[i] = keys[i].cpu;
+    auto_count = k;
+    free(keys);
+    return 0;
+}
+
+/** Looks up a policy variable, the command's own assignments first */
+static char const *
+policy_var(struct command const *cmd, char const *name) {
+    for (size_t i = cmd->assignment_count; i-- > 0;) {
+        if (strcmp(cmd->assignments[i]->name, name) == 0) return cmd->assignments[i]->value;
+    }
+    char const *val = vars_get(name);
+    return val && *val ? val : 0;
+}
+
+void
+placement_from_vars(struct command const *cmd, size_t stage, struct placement *p) {
+    char const *val;
+    if (!p->has_cpus && (val = policy_var(cmd, "MS_CPUS"))) {
+        if (strcmp(val, "auto") == 0) {
+            if (auto_init() == 0 && auto_count) {
+                if (stage == 0) ++auto_next;
+                CPU_ZERO(&p->cpus);
+                CPU_SET(auto_order[(auto_next + stage) % auto_count], &p->cpus);
+                p->has_cpus = 1;
+            }
+        } else if (placement_parse_cpus(val, &p->cpus) == 0) {
+            p->has_cpus = 1;
+        }
+    }
+    if (!p->has_nice && (val = policy_var(cmd, "MS_NICE"))) {
+        char *end = 0;
+        long n = strtol(val, &end, 10);
+        if (!*end && n >= -40 && n <= 40) {
+            p->nice = (int) n;
+            p->has_nice = 1;
+        }
+    }
+    if (!p->has_ioprio && (val = policy_var(cmd, "MS_IOPRIO"))) {
+        if (placement_parse_ioprio(val, &p->ioprio) == 0) p->has_ioprio = 1;
+    }
+}
+
+int
+placement_any(struct placement const *p) {
+    return p->has_cpus || p->has_nice || p->has_ioprio;
+}
+
+int
+placement_apply(struct placement const *p) {
+    if (p->has_cpus && sched_setaffinity(0, sizeof p->cpus, &p->cpus) < 0) return -1;
+    if (p->has_nice) {
+        errno = 0;
+        if (nice(p->nice) == -1 && errno) return -1;
+    }
+    if (p->has_ioprio && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, p->ioprio) < 0) {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+/* cpu_set_t needs _GNU_SOURCE in the including file */
+#include <sched.h>
+#include <stddef.h>
+
+#include "parser.h"
+
+/* Where and how eagerly a command runs */
+struct placement {
+    int has_cpus;
+    cpu_set_t cpus; /* CPUs it may run on */
+    int has_nice;
+    int nice; /* Niceness adjustment, as with nice(1) */
+    int has_ioprio;
+    int ioprio; /* I/O priority, as for ioprio_set(2) */
+};
+
+/** Parses a CPU list, e.g. 0-3,8,10-11
+ *
+ * @returns 0 on success, -1 if invalid
+ */
+extern int placement_parse_cpus(char const *s, cpu_set_t *set);
+
+/** Parses an I/O priority: a class (idle, be, rt, or 1-3), optionally with
+ *  a level (0-7, highest first) after a colon, e.g. be:7
+ *
+ * @returns 0 on success, -1 if invalid
+ */
+extern int placement_parse_ioprio(char const *s, int *ioprio);
+
+/** Parses an I/O class and level given separately, as with ionice(1)
+ *
+ * @param level the level, or null pointer for the class's default
+ * @returns 0 on success, -1 if invalid
+ */
+extern int placement_parse_ionice(char const *class, char const *level, int *ioprio);
+
+/** Fills in what a command's prefixes left unset from $MS_CPUS, $MS_NICE
+ *  and $MS_IOPRIO
+ *
+ * @param stage position of the command in its pipeline, from 0
+ *
+ * The command's own assignments (MS_CPUS=0-3 cmd) take precedence over the
+ * shell's variables. MS_CPUS=auto places consecutive stages of a pipeline on
+ * neighbouring CPUs, siblings of the same core first, so data passed down
+ * the pipeline stays in shared caches; each pipeline starts one CPU further
+ * along, to spread jobs out.
+ */
+extern void placement_from_vars(struct command const *cmd, size_t stage, struct placement *p);
+
+/** Checks if a placement asks for anything */
+extern int placement_any(struct placement const *p);
+
+/** Applies a placement to the calling process, e.g. a child about to exec
+ *
+ * @returns 0 on success, -1 on failure
+ */
+extern int placement_apply(struct placement const *p);
@@ -0,0 +1,10 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "probes.h"
+
+/* Tracers find these through the probes' notes, and write to them; they
+ * must stay, used or not */
+#define PROBE(name) \
+    __attribute__((used, section(".probes"))) unsigned short PROBE_SEMAPHORE(name) = 0;
+#include "probes.def"
+#undef PROBE
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "util/probe.h"
+
+/* Semaphores of the shell's probes, defined in probes.c */
+#define PROBE(name) extern unsigned short PROBE_SEMAPHORE(name);
+#include "probes.def"
+#undef PROBE
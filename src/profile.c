@@ -0,0 +1,195 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+#include "stats.h"
+
+char const *profile_path = 0;
+
+/* Totals for one input line */
+struct line_profile {
+    size_t line;
+    char *text; /* As first run, before expansion */
+    unsigned long long calls;
+    unsigned long long forks;
+    uint64_t wall_ns;
+    uint64_t user_ns; /* Of children reaped while it ran */
+    uint64_t sys_ns;
+};
+
+/* Indexed by line - 1; lines never run have no calls */
+static struct line_profile *lines = 0;
+static size_t line_count = 0;
+
+static uint64_t
+ns_between(struct timespec start, struct timespec end) {
+    return (uint64_t) (end.tv_sec - start.tv_sec) * 1000000000u + end.tv_nsec - start.tv_nsec;
+}
+
+static uint64_t
+tv_ns(struct timeval tv) {
+    return (uint64_t) tv.tv_sec * 1000000000u + (uint64_t) tv.tv_usec * 1000u;
+}
+
+static unsigned long long
+processes_started(void) {
+    return stats_counters[STATS_FORKS] + stats_counters[STATS_SPAWNS];
+}
+
+/** Renders a command list as one line of text, as parsed
+ *
+ * @returns a string to free, or null pointer on failure
+ */
+static char *
+list_text(struct command_list const *cl) {
+    char *text = 0;
+    size_t size = 0;
+    FILE *f = open_memstream(&text, &size);
+    if (!f) return 0;
+    command_list_print(cl, f);
+    if (fclose(f) != 0) return 0;
+
+    /* Drop the separator after the last command */
+    while (size && (text[size - 1] == ' ' || text[size - 1] == ';')) text[--size] = '\0';
+    for (char *c = text; *c; ++c) {
+        if (*c == '\n' || *c == '\t') *c = ' ';
+    }
+    return text;
+}
+
+/** Finds the totals for a line, adding them if new
+ *
+ * @returns null pointer on failure
+ */
+static struct line_profile *
+get_line(struct command_list const *cl) {
+    if (!cl->line) return 0;
+    if (cl->line > line_count) {
+        size_t n = line_count ? line_count : 64;
+        while (n < cl->line) n *= 2;
+        void *tmp = realloc(lines, sizeof *lines * n);
+        if (!tmp) return 0;
+        lines = tmp;
+        memset(&lines[line_count], 0, sizeof *lines * (n - line_count));
+        line_count = n;
+    }
+    struct line_profile *p = &lines[cl->line - 1];
+    if (!p->text) {
+        p->line = cl->line;
+        p->text = list_text(cl);
+        if (!p->text) return 0;
+    }
+    return p;
+}
+
+int
+profile_open(char const *path) {
+    /* Fail now rather than after hours of work, if the report can't be written */
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+    fclose(f);
+    profile_path = strdup(path); /* The variable may change */
+    return profile_path ? 0 : -1;
+}
+
+void
+profile_begin(struct command_list const *cl, struct profile_mark *mark) {
+    if (!profile_path) return;
+    get_line(cl); /* Keep the text from before expansion changes it */
+    getrusage(RUSAGE_CHILDREN, &mark->children);
+    mark->forks = processes_started();
+    clock_gettime(CLOCK_MONOTONIC, &mark->wall);
+}
+
+void
+profile_end(struct command_list const *cl, struct profile_mark const *mark) {
+    if (!profile_path) return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    struct rusage children;
+    getrusage(RUSAGE_CHILDREN, &children);
+
+    struct line_profile *p = get_line(cl);
+    if (!p) return;
+    ++p->calls;
+    p->forks += processes_started() - mark->forks;
+    p->wall_ns += ns_between(mark->wall, now);
+    p->user_ns += tv_ns(children.ru_utime) - tv_ns(mark->children.ru_utime);
+    p->sys_ns += tv_ns(children.ru_stime) - tv_ns(mark->children.ru_stime);
+}
+
+static int
+by_wall(void const *a, void const *b) {
+    struct line_profile const *x = *(struct line_profile *const *) a;
+    struct line_profile const *y = *(struct line_profile *const *) b;
+    if (x->wall_ns != y->wall_ns) return x->wall_ns < y->wall_ns ? 1 : -1;
+    return (x->line > y->line) - (x->line < y->line);
+}
+
+/** Writes one collapsed stack per line, weighted by wall time in microseconds */
+static void
+write_folded(FILE *f, struct line_profile const *const *sorted, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        struct line_profile const *p = sorted[i];
+        /* Frames are split on ';', which separates commands too */
+        fprintf(f, "minishell;line %zu;", p->line);
+        for (char const *c = p->text; *c; ++c) {
+            if (*c != ';') fputc(*c, f);
+            else if (c[1] == ' ') fputc(',', f);
+        }
+        fprintf(f, " %llu\n", (unsigned long long) (p->wall_ns / 1000));
+    }
+}
+
+void
+profile_dump(void) {
+    if (!profile_path) return;
+
+    size_t n = 0;
+    uint64_t total_ns = 0;
+    struct line_profile **sorted = malloc(sizeof *sorted * (line_count ? line_count : 1));
+    if (!sorted) return;
+    for (size_t i = 0; i < line_count; ++i) {
+        if (!lines[i].calls) continue;
+        sorted[n++] = &lines[i];
+        total_ns += lines[i].wall_ns;
+    }
+    qsort(sorted, n, sizeof *sorted, by_wall);
+
+    FILE *f = fopen(profile_path, "w");
+    if (f) {
+        fprintf(f, "# lines run: %zu, wall: %.6fs\n", n, (double) total_ns / 1e9);
+        fprintf(f, "%12s %6s %8s %12s %12s %8s %6s  %s\n",
+                "wall", "%", "calls", "child user", "child sys", "forks", "line", "command");
+        for (size_t i = 0; i < n; ++i) {
+            struct line_profile const *p = sorted[i];
+            fprintf(f, "%11.6fs %5.1f%% %8llu %11.6fs %11.6fs %8llu %6zu  %s\n",
+                    (double) p->wall_ns / 1e9,
+                    total_ns ? 100.0 * (double) p->wall_ns / (double) total_ns : 0.0,
+                    p->calls,
+                    (double) p->user_ns / 1e9,
+                    (double) p->sys_ns / 1e9,
+                    p->forks,
+                    p->line,
+                    p->text);
+        }
+        fclose(f);
+    }
+
+    size_t const len = strlen(profile_path);
+    char *folded_path = malloc(len + sizeof ".folded");
+    if (folded_path) {
+        memcpy(folded_path, profile_path, len);
+        memcpy(folded_path + len, ".folded", sizeof ".folded");
+        f = fopen(folded_path, "w");
+        if (f) {
+            write_folded(f, (struct line_profile const *const *) sorted, n);
+            fclose(f);
+        }
+        free(folded_path);
+    }
+    free(sorted);
+}
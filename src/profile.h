@@ -0,0 +1,45 @@
+#pragma once
+
+#include <sys/resource.h>
+#include <time.h>
+
+#include "parser.h"
+
+/* Line profiler, enabled with MS_PROFILE=/path at startup
+ *
+ * Each command list the shell runs is timed, keyed by the input line it
+ * started on, and runs of the same line add up. When the shell exits, a
+ * report of the lines sorted by wall time goes to the path, and the same
+ * times as collapsed stacks, for flamegraph.pl and the like, to path.folded.
+ *
+ * Child CPU time is counted when children are reaped, so a background job's
+ * goes to whichever line was running when it finished.
+ */
+
+/* Where a command list started from; see profile_begin() */
+struct profile_mark {
+    struct timespec wall;
+    struct rusage children;
+    unsigned long long forks;
+};
+
+/* The report's path, or null pointer if profiling is off */
+extern char const *profile_path;
+
+/** Starts profiling, with the report going to a file on exit
+ *
+ * @returns 0 on success, -1 on failure
+ */
+extern int profile_open(char const *path);
+
+/** Starts timing a command list, before its words are expanded */
+extern void profile_begin(struct command_list const *cl, struct profile_mark *mark);
+
+/** Finishes timing a command list started with profile_begin() */
+extern void profile_end(struct command_list const *cl, struct profile_mark const *mark);
+
+/** Writes the report and collapsed stacks, if profiling
+ *
+ * Done when the shell exits, or replaces itself with a command.
+ */
+extern void profile_dump(void);
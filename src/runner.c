@@ -1,21 +1,39 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 
 #include <assert.h>
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "builtins.h"
 #include "expand.h"
+#include "glob.h"
 #include "jobs.h"
 #include "params.h"
 #include "parser.h"
+#include "pathcache.h"
+#include "pipes.h"
+#include "placement.h"
+#include "probes.h"
+#include "profile.h"
 #include "signal.h"
+#include "spawn.h"
+#include "stats.h"
+#include "timers.h"
+#include "trace.h"
+#include "timing.h"
+#include "util/alloc.h"
 #include "vars.h"
 #include "wait.h"
 
@@ -36,9 +54,8 @@
  * */
 static int
 expand_command_words(struct command *cmd) {
-    for (size_t i = 0; i < cmd->word_count; ++i) {
-        expand(&cmd->words[i]);
-    }
+    struct timespec const start = stats_begin();
+    expand_words(&cmd->words, &cmd->word_count);
 
     for (size_t i = 0; i < cmd->assignment_count; ++i) {
         expand(&cmd->assignments[i]->value);
@@ -47,6 +64,188 @@ expand_command_words(struct command *cmd) {
     for (size_t i = 0; i < cmd->io_redir_count; ++i) {
         expand(&cmd->io_redirs[i]->filename);
     }
+    uint64_t const ns = stats_end(STATS_EXPAND, start);
+    trace_event(TRACE_EXPAND, 0, 0, ns, cmd->word_count ? cmd->words[0] : 0);
+    return 0;
+}
+
+/* What a command's prefixes, e.g. `timeout 5 cmd` or `pin 0-3 cmd`, ask for */
+struct prefixes {
+    int child; /* Some were given, so the command must run in a child */
+
+    int time; /* The time keyword was given: an enum timing_format, for the whole job */
+
+    int timeout; /* A timeout was given, for the whole job */
+    int sig;
+    struct timespec after;
+    struct timespec kill_after;
+
+    struct placement place; /* For this command alone */
+};
+
+/** Parses a signal name (TERM, SIGTERM) or number
+ *
+ * @returns the signal, or -1 if invalid
+ */
+static int
+parse_signal(char const *s) {
+    static struct {
+        char const *name;
+        int sig;
+    } const names[] = {
+            {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+            {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"ALRM", SIGALRM}, {"TERM", SIGTERM},
+            {"CONT", SIGCONT}, {"STOP", SIGSTOP},
+    };
+    char *end = 0;
+    long n = strtol(s, &end, 10);
+    if (*s && !*end) return n > 0 && n < NSIG ? (int) n : -1;
+    if (strncmp(s, "SIG", 3) == 0) s += 3;
+    for (size_t i = 0; i < sizeof names / sizeof *names; ++i) {
+        if (strcmp(s, names[i].name) == 0) return names[i].sig;
+    }
+    return -1;
+}
+
+/** Parses a timeout prefix
+ *
+ * @returns the number of words it takes up, or 0 if it's malformed or uses
+ *          other options, to run timeout(1) instead
+ *
+ * timeout [-s SIG] [-k DURATION] DURATION command...
+ *
+ * Given several, the earliest wins; a zero duration sets none, as with
+ * timeout(1).
+ */
+static size_t
+parse_timeout(struct command const *cmd, struct prefixes *prefix) {
+    int sig = SIGTERM;
+    struct timespec after = {0};
+    struct timespec kill_after = {0};
+    size_t i = 1;
+    for (; i + 1 < cmd->word_count && cmd->words[i][0] == '-'; i += 2) {
+        if (strcmp(cmd->words[i], "-s") == 0) {
+            sig = parse_signal(cmd->words[i + 1]);
+            if (sig < 0) return 0;
+        } else if (strcmp(cmd->words[i], "-k") == 0) {
+            if (timers_parse_duration(cmd->words[i + 1], &kill_after) < 0) return 0;
+        } else {
+            return 0;
+        }
+    }
+    if (i + 1 >= cmd->word_count) return 0;
+    if (timers_parse_duration(cmd->words[i], &after) < 0) return 0;
+
+    if ((after.tv_sec || after.tv_nsec) &&
+        (!prefix->timeout || after.tv_sec < prefix->after.tv_sec ||
+         (after.tv_sec == prefix->after.tv_sec && after.tv_nsec < prefix->after.tv_nsec))) {
+        prefix->timeout = 1;
+        prefix->sig = sig;
+        prefix->after = after;
+        prefix->kill_after = kill_after;
+    }
+    return i + 1;
+}
+
+/** Parses an integer word
+ *
+ * @returns 0 on success, -1 if it isn't one
+ */
+static int
+parse_int(char const *s, int *n) {
+    char *end = 0;
+    long val = strtol(s, &end, 10);
+    if (!*s || *end || val < -40 || val > 40) return -1;
+    *n = (int) val;
+    return 0;
+}
+
+/** Parses a placement prefix: pin, nice or ionice
+ *
+ * @returns the number of words it takes up, or 0 if it's malformed or uses
+ *          other options, to run nice(1) or ionice(1) instead
+ *
+ * pin CPUS command...                   e.g. pin 0-3,8 cmd
+ * nice [N | -N | -n N] command...       niceness adjustment, 10 by default
+ * ionice -c CLASS [-n LEVEL] command...
+ */
+static size_t
+parse_placement(struct command const *cmd, struct prefixes *prefix) {
+    struct placement place = prefix->place;
+    struct placement *p = &place;
+    char **const w = cmd->words;
+    size_t i = 1;
+    if (strcmp(w[0], "pin") == 0) {
+        if (cmd->word_count < 3 || placement_parse_cpus(w[1], &p->cpus) < 0) return 0;
+        p->has_cpus = 1;
+        i = 2;
+    } else if (strcmp(w[0], "nice") == 0) {
+        int n = 10;
+        if (cmd->word_count > 2 && strcmp(w[1], "-n") == 0) {
+            if (parse_int(w[2], &n) < 0) return 0;
+            i = 3;
+        } else if (cmd->word_count > 1 && w[1][0] == '-' && parse_int(w[1] + 1, &n) == 0) {
+            i = 2; /* Traditional -N, meaning N */
+        } else if (cmd->word_count > 1 && parse_int(w[1], &n) == 0) {
+            i = 2;
+        } else if (cmd->word_count > 1 && w[1][0] == '-') {
+            return 0; /* Other options are for nice(1) */
+        }
+        p->nice = (p->has_nice ? p->nice : 0) + n;
+        p->has_nice = 1;
+    } else {
+        char const *class = 0;
+        char const *level = 0;
+        for (; i + 1 < cmd->word_count && w[i][0] == '-'; i += 2) {
+            if (strcmp(w[i], "-c") == 0) class = w[i + 1];
+            else if (strcmp(w[i], "-n") == 0) level = w[i + 1];
+            else return 0; /* Other options are for ionice(1) */
+        }
+        if (!class || placement_parse_ionice(class, level, &p->ioprio) < 0) return 0;
+        p->has_ioprio = 1;
+    }
+    if (i >= cmd->word_count) return 0;
+    prefix->place = place;
+    return i;
+}
+
+/** Strips prefixes off the front of a command
+ *
+ * @param [out]prefix what they ask for
+ * @returns 0 on success, -1 if one is malformed; it's left in place, to run
+ *          as a command of that name (e.g. the time builtin reports it, and
+ *          timeout(1) handles options the shell doesn't)
+ *
+ * A timeout or time applies to the command's whole job; placements to the
+ * command alone.
+ */
+static int
+strip_prefixes(struct command *cmd, struct prefixes *prefix) {
+    *prefix = (struct prefixes) {0};
+    while (cmd->word_count) {
+        char const *name = cmd->words[0];
+        size_t n = 0;
+        if (strcmp(name, "time") == 0) {
+            /* time [-p] command... */
+            n = cmd->word_count > 1 && strcmp(cmd->words[1], "-p") == 0 ? 2 : 1;
+            if (n >= cmd->word_count) return -1;
+            prefix->time = n == 2 ? TIMING_POSIX : TIMING_DEFAULT;
+        } else if (strcmp(name, "timeout") == 0) {
+            n = parse_timeout(cmd, prefix);
+        } else if (strcmp(name, "pin") == 0 || strcmp(name, "nice") == 0 ||
+                   strcmp(name, "ionice") == 0) {
+            n = parse_placement(cmd, prefix);
+        } else {
+            break;
+        }
+        if (n == 0) return -1;
+
+        /* Timing alone doesn't need a child: builtins are timed in the shell */
+        if (strcmp(name, "time") != 0) prefix->child = 1;
+        for (size_t k = 0; k < n; ++k) free(cmd->words[k]);
+        memmove(cmd->words, &cmd->words[n], sizeof *cmd->words * (cmd->word_count - n + 1));
+        cmd->word_count -= n;
+    }
     return 0;
 }
 
@@ -70,7 +269,7 @@ do_variable_assignment(struct command const *cmd, int export_all) {
     return 0;
 }
 
-static int
+int
 get_io_flags(enum io_operator io_op) {
     int flags = 0;
     /*
@@ -167,7 +366,7 @@ do_builtin_io_redirects(struct command *cmd, struct builtin_redir **redir_list)
                     }
                 }
                 if (rec == 0) {
-                    rec = malloc(sizeof *rec);
+                    rec = alloc_malloc(ALLOC_RUNNER, sizeof *rec);
                     if (!rec) goto err;
                     rec->pseudofd = r->io_number;
                     rec->realfd = -1;
@@ -194,7 +393,7 @@ do_builtin_io_redirects(struct command *cmd, struct builtin_redir **redir_list)
                         }
                     }
                     if (rec == 0) {
-                        rec = malloc(sizeof *rec);
+                        rec = alloc_malloc(ALLOC_RUNNER, sizeof *rec);
                         if (!rec) goto err;
                         rec->pseudofd = r->io_number;
                         rec->realfd = dup(src);
@@ -218,7 +417,7 @@ do_builtin_io_redirects(struct command *cmd, struct builtin_redir **redir_list)
                 }
             }
             if (rec == 0) {
-                rec = malloc(sizeof *rec);
+                rec = alloc_malloc(ALLOC_RUNNER, sizeof *rec);
                 if (!rec) goto err;
                 rec->pseudofd = r->io_number;
                 rec->realfd = fd;
@@ -277,15 +476,927 @@ do_io_redirects(struct command *cmd) {
     return status;
 }
 
+/** Saves copies of the descriptors a command's redirections will replace
+ *
+ * @returns one copy per redirection, or -1 where the descriptor wasn't open,
+ *          for restore_fds(); null pointer on failure
+ *
+ * Copies are close-on-exec, above every descriptor the redirections name.
+ */
+static int *
+save_fds(struct command const *cmd) {
+    int lowest = 10;
+    for (size_t i = 0; i < cmd->io_redir_count; ++i) {
+        if (cmd->io_redirs[i]->io_number >= lowest) lowest = cmd->io_redirs[i]->io_number + 1;
+    }
+    int *saved = alloc_malloc(ALLOC_RUNNER, sizeof *saved * (cmd->io_redir_count + 1));
+    if (!saved) return 0;
+    for (size_t i = 0; i < cmd->io_redir_count; ++i) {
+        saved[i] = fcntl(cmd->io_redirs[i]->io_number, F_DUPFD_CLOEXEC, lowest);
+        if (saved[i] < 0 && errno != EBADF) {
+            while (i-- > 0) {
+                if (saved[i] >= 0) close(saved[i]);
+            }
+            free(saved);
+            return 0;
+        }
+    }
+    errno = 0;
+    return saved;
+}
+
+/** Puts back the descriptors save_fds() copied, and frees the copies */
+static void
+restore_fds(struct command const *cmd, int *saved) {
+    for (size_t i = cmd->io_redir_count; i-- > 0;) {
+        int const fd = cmd->io_redirs[i]->io_number;
+        if (saved[i] >= 0) move_fd(saved[i], fd);
+        else close(fd);
+    }
+    free(saved);
+}
+
+/** Runs a builtin within the shell, on top of pseudo-redirections
+ *
+ * @param stdin_override  pipe to use as stdin, or -1
+ * @param stdout_override pipe to use as stdout, or -1
+ * @returns the builtin's result, or -1 on failure
+ *
+ * The overrides are owned by the redirection list, and are closed along with
+ * it once the builtin returns.
+ */
+static int
+run_builtin(struct command *cmd,
+            builtin_fn builtin,
+            int stdin_override,
+            int stdout_override) {
+    struct builtin_redir *redir_list = 0;
+    int *saved = 0;
+    int result = -1;
+
+    if (stdin_override >= 0) {
+        struct builtin_redir *rec = alloc_malloc(ALLOC_RUNNER, sizeof *rec);
+        if (!rec) goto out;
+        rec->pseudofd = STDIN_FILENO;
+        rec->realfd = stdin_override;
+        rec->next = redir_list;
+        redir_list = rec;
+    }
+    if (stdout_override >= 0) {
+        struct builtin_redir *rec = alloc_malloc(ALLOC_RUNNER, sizeof *rec);
+        if (!rec) goto out;
+        rec->pseudofd = STDOUT_FILENO;
+        rec->realfd = stdout_override;
+        rec->next = redir_list;
+        redir_list = rec;
+    }
+
+    if (builtin_flags(builtin) & BUILTIN_SHELL_REDIRS) {
+        /* Redirect for real, and for good */
+        while (redir_list) {
+            struct builtin_redir *rec = redir_list;
+            if (move_fd(rec->realfd, rec->pseudofd) < 0) goto out;
+            redir_list = rec->next;
+            free(rec);
+        }
+        /* Given a command (`exec cmd >log`), the redirections are the
+         * command's, and only stay if it replaces the shell */
+        if (cmd->word_count > 1 && !(saved = save_fds(cmd))) goto out;
+        if (do_io_redirects(cmd) < 0) {
+            warn("%s", cmd->words[0]);
+            goto out;
+        }
+    } else {
+        do_builtin_io_redirects(cmd, &redir_list);
+    }
+
+    do_variable_assignment(cmd, 0);
+
+    stats_add(STATS_BUILTINS, 1);
+    result = builtin(cmd, redir_list);
+
+    out:
+    if (saved) restore_fds(cmd, saved);
+    while (redir_list) {
+        close(redir_list->realfd);
+        void *tmp = redir_list;
+        redir_list = redir_list->next;
+        free(tmp);
+    }
+    return result;
+}
+
+/** Runs a builtin pipeline stage within the shell, without forking for it
+ *
+ * @param stdout_override write end of the stage's output pipe
+ * @param next_stdin      read end of the same pipe
+ * @returns the builtin's result, or -1 on failure
+ *
+ * The builtin writes to a memory file rather than to the pipe, since the
+ * stage reading the pipe hasn't been started yet. Whatever fits is moved to
+ * the pipe straight away. Only if more is left is a child forked to write
+ * it; being a process of its own, it goes on even if the shell execs or
+ * exits, and it's reaped like any child outside a job.
+ */
+static int
+run_builtin_stage(struct command *cmd,
+                  builtin_fn builtin,
+                  int stdin_override,
+                  int stdout_override,
+                  int next_stdin) {
+    int capture = memfd_create("minishell-builtin", MFD_CLOEXEC);
+    if (capture < 0) return -1;
+    /* The builtin's own redirections may reuse the descriptor it is given */
+    int output = fcntl(capture, F_DUPFD_CLOEXEC, 0);
+    if (output < 0) {
+        close(capture);
+        return -1;
+    }
+
+    int result = run_builtin(cmd, builtin, stdin_override, capture);
+
+    off_t offset = 0;
+    off_t size = lseek(output, 0, SEEK_END);
+    int flags = fcntl(stdout_override, F_GETFL);
+    if (size > 0 && flags >= 0 && fcntl(stdout_override, F_SETFL, flags | O_NONBLOCK) == 0) {
+        while (offset < size) {
+            ssize_t res = sendfile(stdout_override, output, &offset, size - offset);
+            if (res <= 0) break;
+        }
+        fcntl(stdout_override, F_SETFL, flags);
+    }
+
+    if (offset < size) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            /* Holding the read end would keep a reader gone from raising EPIPE */
+            close(next_stdin);
+            while (offset < size) {
+                ssize_t res = sendfile(stdout_override, output, &offset, size - offset);
+                if (res < 0 && errno == EINTR) continue;
+                if (res <= 0) break; /* EPIPE: the reader is gone */
+            }
+            _exit(0);
+        }
+        if (pid < 0) warn("%s", cmd->words[0]);
+    }
+    close(stdout_override);
+    close(output);
+    return result;
+}
+
+/** Finds an external command on PATH before forking, so the shell's cache
+ *  keeps what the lookup finds
+ *
+ * @returns the path, valid until the next call into the cache, or null
+ *          pointer to leave the search to the child
+ *
+ * A command assigning PATH is left to the child, which searches the PATH it
+ * assigns.
+ */
+static char const *
+command_path(struct command const *cmd, builtin_fn builtin) {
+    if (builtin || strchr(cmd->words[0], '/')) return 0;
+    for (size_t i = 0; i < cmd->assignment_count; ++i) {
+        if (strcmp(cmd->assignments[i]->name, "PATH") == 0) return 0;
+    }
+    return pathcache_lookup(cmd->words[0]);
+}
+
+/** Body of a forked child process running one command; never returns
+ *
+ * @param path where an external command was found, from command_path()
+ */
+static void
+run_child(struct command *cmd,
+          builtin_fn builtin,
+          char const *path,
+          int stdin_override,
+          int stdout_override) {
+    if (builtin) {
+        int result = run_builtin(cmd, builtin, stdin_override, stdout_override);
+        exit(result < 0 ? 127 : result);
+    }
+
+    if (stdin_override >= 0) {
+        if (move_fd(stdin_override, STDIN_FILENO) == -1) err(1, 0);
+    }
+
+    if (stdout_override >= 0) {
+        if (move_fd(stdout_override, STDOUT_FILENO) == -1) err(1, 0);
+    }
+
+    if (do_io_redirects(cmd) < 0) err(1, 0);
+
+    if (do_variable_assignment(cmd, 1) < 0) err(1, 0);
+
+    if (signal_restore() < 0) err(1, 0);
+
+    PROBE2(exec, getpid(), cmd->words[0]);
+    if (trace_buffer) trace_record(TRACE_EXEC, getpid(), getpgrp(), 0, cmd->words[0]);
+    if (path) execv(path, cmd->words);
+    execvp(cmd->words[0], cmd->words);
+
+    err(127, 0);
+}
+
+/** Writes a whole buffer to a file descriptor
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static int
+write_all(int fd, char const *buf, size_t len) {
+    while (len > 0) {
+        ssize_t res = write(fd, buf, len);
+        if (res < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += res;
+        len -= res;
+    }
+    return 0;
+}
+
+/* Input block size of the parallel pipe operators */
+enum { PARALLEL_BLOCK = 1 << 20 };
+
+/** Translates a wait status into an exit status
+ *
+ * @returns 0 on success, or the nonzero status a shell would report
+ */
+static int
+exit_status(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return 0;
+}
+
+/** Forks a worker copy of a parallel stage
+ *
+ * @returns the worker's pid, or -1 on failure
+ *
+ * Workers inherit the distributor's process group.
+ */
+static pid_t
+fork_worker(struct command *cmd, builtin_fn builtin, int in, int out) {
+    char const *const path = command_path(cmd, builtin);
+    pid_t pid = fork();
+    if (pid == 0) {
+        signal(SIGPIPE, SIG_DFL);
+        run_child(cmd, builtin, path, in, out);
+    }
+    if (pid > 0 && trace_buffer) trace_record(TRACE_FORK, pid, getpgrp(), 0, cmd->words[0]);
+    return pid;
+}
+
+/** Deals lines of input out to workers in round-robin blocks (|*N)
+ *
+ * @param in  the stage's input
+ * @param out the stage's output, shared by all workers
+ * @param n   number of workers
+ * @returns 0 if all workers succeeded, else the last failing exit status
+ *
+ * Each read takes whatever is available, up to PARALLEL_BLOCK. The block is
+ * cut after its last newline (memrchr() is vectorized in glibc), and the
+ * partial line carries over to the next block.
+ */
+static int
+distribute_round_robin(struct command *cmd, builtin_fn builtin, int in, int out, size_t n) {
+    int status = 0;
+    int *fds = alloc_malloc(ALLOC_RUNNER, sizeof *fds * n);
+    pid_t *pids = alloc_malloc(ALLOC_RUNNER, sizeof *pids * n);
+    char *buf = alloc_malloc(ALLOC_RUNNER, PARALLEL_BLOCK);
+    if (!fds || !pids || !buf) err(1, 0);
+
+    for (size_t k = 0; k < n; ++k) {
+        int p[2];
+        if (pipe_open(p) == -1) err(1, 0);
+        int const worker_out = fcntl(out, F_DUPFD_CLOEXEC, 0);
+        if (worker_out < 0) err(1, 0);
+        pids[k] = fork_worker(cmd, builtin, p[0], worker_out);
+        if (pids[k] < 0) err(1, 0);
+        close(worker_out);
+        close(p[0]);
+        fds[k] = p[1];
+    }
+    close(out);
+
+    size_t live = n;
+    size_t next = 0;
+    size_t len = 0;
+    for (;;) {
+        ssize_t res = read(in, buf + len, PARALLEL_BLOCK - len);
+        if (res < 0 && errno == EINTR) continue;
+        if (res < 0) err(1, 0);
+        len += res;
+
+        size_t cut = len;
+        if (res > 0) {
+            char *nl = memrchr(buf, '\n', len);
+            if (nl) {
+                cut = nl - buf + 1;
+            } else if (len < PARALLEL_BLOCK) {
+                continue; /* Wait for the line to finish */
+            }
+        }
+        if (cut == 0) break;
+
+        /* Skip workers that have gone away */
+        while (fds[next] < 0) next = (next + 1) % n;
+        if (write_all(fds[next], buf, cut) < 0) {
+            if (errno != EPIPE) err(1, 0);
+            close(fds[next]);
+            fds[next] = -1;
+            if (--live == 0) break;
+        }
+        next = (next + 1) % n;
+
+        memmove(buf, buf + cut, len - cut);
+        len -= cut;
+        if (res == 0 && len == 0) break;
+    }
+
+    for (size_t k = 0; k < n; ++k) {
+        if (fds[k] >= 0) close(fds[k]);
+    }
+    for (size_t k = 0; k < n; ++k) {
+        int wstatus;
+        if (waitpid(pids[k], &wstatus, 0) < 0) err(1, 0);
+        if (exit_status(wstatus)) status = exit_status(wstatus);
+    }
+    free(buf);
+    free(pids);
+    free(fds);
+    return status;
+}
+
+/** Copies the whole content of a file to a file descriptor
+ *
+ * @param scratch buffer for when sendfile() can't write to out
+ * @returns 0 on success, -1 on failure
+ */
+static int
+copy_file(int in, int out, char *scratch, size_t scratch_size) {
+    off_t offset = 0;
+    off_t size = lseek(in, 0, SEEK_END);
+    if (size < 0) return -1;
+    while (offset < size) {
+        ssize_t res = sendfile(out, in, &offset, size - offset);
+        if (res < 0 && errno == EINVAL) break; /* e.g. out is O_APPEND */
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) return -1;
+    }
+    while (offset < size) {
+        size_t len = size - offset < (off_t) scratch_size ? size - offset : scratch_size;
+        ssize_t res = pread(in, scratch, len, offset);
+        if (res <= 0 || write_all(out, scratch, res) < 0) return -1;
+        offset += res;
+    }
+    return 0;
+}
+
+/** Runs one worker per block, and emits outputs in input order (|=N)
+ *
+ * @param in  the stage's input
+ * @param out the stage's output
+ * @param n   maximum number of workers running at once
+ * @returns 0 if all workers succeeded, else the last failing exit status
+ *
+ * Since a worker's output can't otherwise be tied back to its input, each
+ * block gets a fresh worker reading from, and writing to, its own memory
+ * file. Up to n workers run at once; the oldest is waited on and its output
+ * copied out before another starts, so output follows input order.
+ */
+static int
+distribute_ordered(struct command *cmd, builtin_fn builtin, int in, int out, size_t n) {
+    int status = 0;
+    struct slot {
+        pid_t pid;
+        int output;
+    } *ring = alloc_calloc(ALLOC_RUNNER, n, sizeof *ring);
+    char *buf = alloc_malloc(ALLOC_RUNNER, PARALLEL_BLOCK);
+    char *scratch = alloc_malloc(ALLOC_RUNNER, PIPE_BUF);
+    if (!ring || !buf || !scratch) err(1, 0);
+
+    size_t head = 0;  /* Oldest running worker */
+    size_t count = 0; /* Workers running */
+    size_t len = 0;
+    int eof = 0;
+    while (!eof || len > 0 || count > 0) {
+        /* Fill up a block */
+        while (!eof && len < PARALLEL_BLOCK) {
+            ssize_t res = read(in, buf + len, PARALLEL_BLOCK - len);
+            if (res < 0 && errno == EINTR) continue;
+            if (res < 0) err(1, 0);
+            if (res == 0) eof = 1;
+            len += res;
+        }
+
+        if (count == n || (len == 0 && count > 0)) {
+            /* Collect the oldest worker's output */
+            struct slot *s = &ring[head];
+            int wstatus;
+            if (waitpid(s->pid, &wstatus, 0) < 0) err(1, 0);
+            if (exit_status(wstatus)) status = exit_status(wstatus);
+
+            if (copy_file(s->output, out, scratch, PIPE_BUF) < 0) {
+                if (errno != EPIPE) err(1, 0);
+                eof = 1; /* Nobody is listening; finish up */
+                len = 0;
+            }
+            close(s->output);
+            head = (head + 1) % n;
+            --count;
+            continue;
+        }
+        if (len == 0) break;
+
+        size_t cut = len;
+        char *nl = memrchr(buf, '\n', len);
+        if (nl && !eof) cut = nl - buf + 1;
+
+        int input = memfd_create("minishell-block", MFD_CLOEXEC);
+        int output = memfd_create("minishell-output", MFD_CLOEXEC);
+        if (input < 0 || output < 0) err(1, 0);
+        if (write_all(input, buf, cut) < 0) err(1, 0);
+        if (lseek(input, 0, SEEK_SET) < 0) err(1, 0);
+
+        struct slot *s = &ring[(head + count) % n];
+        /* The worker gets its own descriptor for the output; ours is only
+         * kept until the output has been copied out */
+        int const worker_out = fcntl(output, F_DUPFD_CLOEXEC, 0);
+        if (worker_out < 0) err(1, 0);
+        s->pid = fork_worker(cmd, builtin, input, worker_out);
+        if (s->pid < 0) err(1, 0);
+        close(worker_out);
+        s->output = output;
+        ++count;
+        close(input);
+
+        memmove(buf, buf + cut, len - cut);
+        len -= cut;
+    }
+    close(out);
+    free(scratch);
+    free(buf);
+    free(ring);
+    return status;
+}
+
+/** Body of a parallel stage's distributor child; never returns
+ *
+ * The distributor stands in for the stage in the pipeline, and starts the
+ * actual workers as its own children, within the same process group.
+ */
+static void
+run_parallel(struct command *cmd,
+             builtin_fn builtin,
+             int stdin_override,
+             int stdout_override) {
+    if (stdin_override >= 0) {
+        if (move_fd(stdin_override, STDIN_FILENO) == -1) err(1, 0);
+    }
+
+    if (stdout_override >= 0) {
+        if (move_fd(stdout_override, STDOUT_FILENO) == -1) err(1, 0);
+    }
+
+    /* Redirections apply to the stage as a whole, not to each worker */
+    if (do_io_redirects(cmd) < 0) err(1, 0);
+    cmd->io_redir_count = 0;
+
+    int in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+    int out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (in < 0 || out < 0) err(1, 0);
+
+    if (signal_restore() < 0) err(1, 0);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (cmd->ordered) {
+        exit(distribute_ordered(cmd, builtin, in, out, cmd->workers));
+    } else {
+        exit(distribute_round_robin(cmd, builtin, in, out, cmd->workers));
+    }
+}
+
+/** Forks a child to run one pipeline stage
+ *
+ * @param pgid       process group to place the child in, or 0 to start a new one
+ * @param next_stdin read end of the stage's output pipe, or -1
+ * @returns the child's pid, or -1 on failure
+ *
+ * The overrides are closed in the parent once the child has them. Pipes are
+ * close-on-exec, but children that never exec (builtins, distributors) have
+ * to drop the read end of their own output pipe explicitly; otherwise the
+ * pipe would never report a broken pipe.
+ *
+ * External commands are started with posix_spawn() where possible; only
+ * builtins, parallel stages, commands with a placement (which posix_spawn()
+ * has no attributes for), and the odd command spawn_external() turns down
+ * pay for a fork.
+ */
+static pid_t
+spawn_stage(struct command *cmd,
+            builtin_fn builtin,
+            int stdin_override,
+            int stdout_override,
+            int next_stdin,
+            pid_t pgid,
+            struct placement const *place) {
+    if (!builtin && !cmd->workers && !placement_any(place)) {
+        pid_t child_pid = spawn_external(cmd, stdin_override, stdout_override, pgid);
+        if (child_pid != 0) {
+            if (stdout_override >= 0) close(stdout_override);
+            if (stdin_override >= 0) close(stdin_override);
+            return child_pid;
+        }
+    }
+
+    char const *const path = cmd->workers ? 0 : command_path(cmd, builtin);
+    stats_add(STATS_FORKS, 1);
+    stats_add(builtin ? STATS_BUILTINS : STATS_EXECS, 1);
+    pid_t child_pid = fork();
+    if (child_pid == -1) return -1;
+    if (child_pid == 0) {
+        if (setpgid(0, pgid) < 0) err(1, 0);
+        if (next_stdin >= 0) close(next_stdin);
+        /* Workers inherit the distributor's */
+        if (placement_apply(place) < 0) warn("%s", cmd->words[0]);
+        if (cmd->workers) {
+            run_parallel(cmd, builtin, stdin_override, stdout_override);
+        } else {
+            run_child(cmd, builtin, path, stdin_override, stdout_override);
+        }
+        assert(0);
+    }
+
+    PROBE3(fork, child_pid, pgid ? pgid : child_pid, cmd->words[0]);
+    trace_event(TRACE_FORK, child_pid, pgid ? pgid : child_pid, 0, cmd->words[0]);
+    if (stdout_override >= 0) close(stdout_override);
+    if (stdin_override >= 0) close(stdin_override);
+
+    /* Both sides set the group; the child may already have exec'd (EACCES) */
+    if (setpgid(child_pid, pgid) < 0 && errno != EACCES) return -1;
+    errno = 0;
+    return child_pid;
+}
+
+/** Copies everything from one pipe into several others
+ *
+ * @param in  read end of the source pipe
+ * @param out write ends of the destination pipes
+ * @param n   number of destination pipes
+ * @returns 0 on success, -1 on failure
+ *
+ * Data is duplicated in the kernel with tee(2), and the last destination
+ * consumes it with splice(2). tee(2) can come up short when a destination is
+ * full; since it always starts at the head of the source pipe, the shortfall
+ * for that chunk is made up by reading it out and writing the remainder.
+ *
+ * Destinations whose readers have gone away are dropped. Copying stops once
+ * the source reaches end of file or no destinations are left.
+ */
+static int
+fanout_copy(int in, int *out, size_t n) {
+    enum { CHUNK = 1 << 20 };
+    int status = 0;
+    size_t *sent = alloc_malloc(ALLOC_RUNNER, sizeof *sent * n);
+    char *buf = 0;
+    size_t buf_size = 0;
+    if (!sent) goto err;
+
+    while (n > 0) {
+        ssize_t len;
+        if (n == 1) {
+            len = splice(in, 0, out[0], 0, CHUNK, SPLICE_F_MOVE);
+            if (len < 0 && errno == EPIPE) break;
+            if (len < 0) goto err;
+            if (len == 0) break;
+            continue;
+        }
+
+        len = tee(in, out[0], CHUNK, 0);
+        if (len < 0 && errno == EPIPE) goto drop_0;
+        if (len < 0) goto err;
+        if (len == 0) break;
+
+        /* Duplicate the same chunk to all but the last destination */
+        int short_copy = 0;
+        sent[0] = len;
+        for (size_t k = 1; k < n - 1; ++k) {
+            ssize_t res = tee(in, out[k], len, 0);
+            if (res < 0 && errno != EPIPE) goto err;
+            sent[k] = res < 0 ? (size_t) len : (size_t) res;
+            if (res < 0) out[k] = -1;
+            if (sent[k] < (size_t) len) short_copy = 1;
+        }
+
+        if (!short_copy) {
+            /* The last destination consumes the chunk */
+            for (ssize_t moved = 0; moved < len;) {
+                ssize_t res = splice(in, 0, out[n - 1], 0, len - moved, SPLICE_F_MOVE);
+                if (res < 0 && errno == EPIPE) {
+                    out[n - 1] = -1;
+                    /* Discard the rest of the chunk */
+                    short_copy = 1;
+                    for (size_t k = 0; k < n - 1; ++k) sent[k] = len;
+                    len -= moved;
+                    break;
+                }
+                if (res <= 0) goto err;
+                moved += res;
+            }
+        } else {
+            sent[n - 1] = 0;
+        }
+
+        if (short_copy) {
+            if (buf_size < (size_t) len) {
+                void *tmp = alloc_realloc(ALLOC_RUNNER, buf, len);
+                if (!tmp) goto err;
+                buf = tmp;
+                buf_size = len;
+            }
+            for (ssize_t got = 0; got < len;) {
+                ssize_t res = read(in, buf + got, len - got);
+                if (res <= 0) goto err;
+                got += res;
+            }
+            for (size_t k = 0; k < n; ++k) {
+                if (out[k] < 0) continue;
+                for (size_t off = sent[k]; off < (size_t) len;) {
+                    ssize_t res = write(out[k], buf + off, len - off);
+                    if (res < 0 && errno == EPIPE) {
+                        out[k] = -1;
+                        break;
+                    }
+                    if (res < 0) goto err;
+                    off += res;
+                }
+            }
+        }
+
+        /* Drop destinations that went away */
+        for (size_t k = 0; k < n;) {
+            if (out[k] < 0) {
+                out[k] = out[--n];
+            } else {
+                ++k;
+            }
+        }
+        continue;
+
+        drop_0:
+        close(out[0]);
+        out[0] = out[--n];
+    }
+
+    if (0) {
+        err:
+        status = -1;
+    }
+    free(buf);
+    free(sent);
+    return status;
+}
+
+static int spawn_branch(struct command_list *branch, int stdin_fd, pid_t pgid);
+
+/** Starts the branches of a fan-out group
+ *
+ * @param cmd    the producing command, with at least one branch
+ * @param fan_fd read end of the pipe the producer writes to
+ * @param pgid   process group of the producer
+ * @returns 0 on success, -1 on failure
+ *
+ * A helper child copies the producer's output into one pipe per branch, and
+ * each branch runs as a pipeline reading from its own pipe. Everything joins
+ * the producer's process group, so the whole tree is a single job.
+ */
+static int
+spawn_fanout(struct command *cmd, int fan_fd, pid_t pgid) {
+    size_t const n = cmd->fanout_count;
+    int *fds = alloc_malloc(ALLOC_RUNNER, sizeof *fds * 2 * n);
+    if (!fds) goto err;
+    for (size_t k = 0; k < n; ++k) {
+        /* Being close-on-exec keeps each branch from holding its siblings' pipes */
+        if (pipe_open(&fds[2 * k]) == -1) err(1, 0);
+    }
+
+    stats_add(STATS_FORKS, 1);
+    pid_t helper = fork();
+    if (helper == -1) err(1, 0);
+    if (helper == 0) {
+        if (setpgid(0, pgid) < 0) err(1, 0);
+        int *out = alloc_malloc(ALLOC_RUNNER, sizeof *out * n);
+        if (!out) err(1, 0);
+        for (size_t k = 0; k < n; ++k) {
+            close(fds[2 * k]);
+            out[k] = fds[2 * k + 1];
+        }
+        if (signal_restore() < 0) err(1, 0);
+        signal(SIGPIPE, SIG_IGN);
+        exit(fanout_copy(fan_fd, out, n) < 0 ? 1 : 0);
+    }
+    if (setpgid(helper, pgid) < 0) goto err;
+    trace_event(TRACE_FORK, helper, pgid, 0, "fan-out");
+    if (jobs_add_process(jobs_get_jid(pgid), helper) < 0) goto err;
+    close(fan_fd);
+
+    for (size_t k = 0; k < n; ++k) close(fds[2 * k + 1]);
+    for (size_t k = 0; k < n; ++k) {
+        if (spawn_branch(cmd->fanout[k], fds[2 * k], pgid) < 0) goto err;
+    }
+    free(fds);
+    return 0;
+    err:
+    free(fds);
+    return -1;
+}
+
+/** Starts every command of a fan-out branch as a pipeline
+ *
+ * @param stdin_fd read end of the pipe feeding the branch
+ * @returns 0 on success, -1 on failure
+ *
+ * Nothing runs within the shell here, builtins included; the branch is part
+ * of a job that is waited on as a whole.
+ */
+static int
+spawn_branch(struct command_list *branch, int stdin_fd, pid_t pgid) {
+    int stdin_override = stdin_fd;
+    for (size_t i = 0; i < branch->command_count; ++i) {
+        struct command *cmd = branch->commands[i];
+        expand_command_words(cmd);
+        struct prefixes prefix;
+        strip_prefixes(cmd, &prefix);
+        placement_from_vars(cmd, i + 1, &prefix.place);
+
+        int pipeline_fds[2] = {-1, -1};
+        if (cmd->ctrl_op == '|' || cmd->fanout_count) {
+            if (pipe_open(pipeline_fds) == -1) err(1, 0);
+        }
+
+        pid_t child_pid = spawn_stage(cmd,
+                                      get_builtin(cmd),
+                                      stdin_override,
+                                      pipeline_fds[STDOUT_FILENO],
+                                      pipeline_fds[STDIN_FILENO],
+                                      pgid,
+                                      &prefix.place);
+        if (child_pid < 0) return -1;
+        if (jobs_add_process(jobs_get_jid(pgid), child_pid) < 0) return -1;
+        if (prefix.timeout &&
+            timers_add(jobs_get_jid(pgid), prefix.sig, prefix.after, prefix.kill_after) < 0) {
+            return -1;
+        }
+        if (prefix.time) jobs_set_measured(jobs_get_jid(pgid), prefix.time);
+
+        stdin_override = pipeline_fds[STDIN_FILENO];
+        if (cmd->fanout_count) {
+            if (spawn_fanout(cmd, stdin_override, pgid) < 0) return -1;
+            stdin_override = -1;
+        }
+    }
+    return 0;
+}
+
+/* Background pipelines waiting for room under $MS_MAX_JOBS, oldest first:
+ * queue[queue_head] up to queue[queue_count - 1] */
+static struct queued_job {
+    jid_t jid;
+    struct command_list *cl; /* Words already expanded */
+} *queue = 0;
+static size_t queue_head = 0;
+static size_t queue_count = 0;
+
+/** Parses $MS_MAX_JOBS
+ *
+ * @returns the most background jobs to run at once, or 0 for no limit
+ */
+static size_t
+max_jobs(void) {
+    char const *s = vars_get("MS_MAX_JOBS");
+    if (!s || !*s) return 0;
+
+    char *end = 0;
+    long n = strtol(s, &end, 10);
+    if (*end || n <= 0) return 0;
+    return (size_t) n;
+}
+
+void
+runner_cleanup(void) {
+    for (size_t i = queue_head; i < queue_count; ++i) {
+        command_list_free(queue[i].cl);
+        free(queue[i].cl);
+    }
+    free(queue);
+    queue = 0;
+    queue_head = queue_count = 0;
+}
+
+/** Queues a background pipeline, to be started by run_queued()
+ *
+ * @param first the pipeline's first command, already expanded
+ * @param last  its last command, the one ending with '&'
+ * @returns the job id reserved for it, or -1 on failure
+ *
+ * The remaining commands are expanded now, as they would have been had the
+ * pipeline started right away, and are moved out of cl into the queue.
+ */
+static jid_t
+queue_pipeline(struct command_list *cl, size_t first, size_t last) {
+    struct command_list *q = alloc_malloc(ALLOC_RUNNER, sizeof *q);
+    if (!q) return -1;
+    q->command_count = last - first + 1;
+    q->line = cl->line;
+    q->commands = alloc_malloc(ALLOC_RUNNER, sizeof *q->commands * q->command_count);
+    if (!q->commands) goto err;
+
+    if (queue_head && 2 * queue_head >= queue_count) {
+        memmove(queue, &queue[queue_head], sizeof *queue * (queue_count - queue_head));
+        queue_count -= queue_head;
+        queue_head = 0;
+    }
+    void *tmp = alloc_realloc(ALLOC_RUNNER, queue, sizeof *queue * (queue_count + 1));
+    if (!tmp) goto err;
+    queue = tmp;
+
+    /* Only the shell starts them; a forked child reaping its own children
+     * must not */
+    static int registered = 0;
+    if (!registered && pthread_atfork(0, 0, runner_cleanup) == 0) registered = 1;
+
+    jid_t jid = jobs_add_queued();
+    if (jid < 0) goto err;
+
+    for (size_t k = 0; k < q->command_count; ++k) {
+        if (k) expand_command_words(cl->commands[first + k]);
+        q->commands[k] = cl->commands[first + k];
+        cl->commands[first + k] = 0;
+    }
+    queue[queue_count++] = (struct queued_job) {.jid = jid, .cl = q};
+    return jid;
+
+    err:
+    free(q->commands);
+    free(q);
+    return -1;
+}
+
+static int run_commands(struct command_list *cl, int flags, jid_t jid);
+
+void
+run_queued(size_t exempt) {
+    static int launching = 0;
+    if (launching) return; /* Nothing started here reaps, but be sure */
+    launching = 1;
+
+    while (queue_head < queue_count) {
+        size_t const limit = max_jobs();
+        if (limit && jobs_count_active() >= limit + exempt) break;
+
+        struct queued_job q = queue[queue_head++];
+        if (run_commands(q.cl, 0, q.jid) < 0) warn("[%jd]", (intmax_t) q.jid);
+        if (jobs_get_state(q.jid) == JOB_QUEUED) jobs_remove(q.jid);
+        command_list_free(q.cl);
+        free(q.cl);
+    }
+    if (queue_head == queue_count) queue_head = queue_count = 0;
+
+    launching = 0;
+}
+
 int
-run_command_list(struct command_list *cl) {
+run_command_list(struct command_list *cl, int flags) {
+    struct timespec const start = stats_begin();
+    struct profile_mark mark;
+    profile_begin(cl, &mark);
+    int res = run_commands(cl, flags, -1);
+    profile_end(cl, &mark);
+    glob_cache_clear();
+    stats_end(STATS_RUN, start);
+    return res;
+}
+
+/** Runs a command list
+ *
+ * @param jid a queued job to start the list as, its words already expanded;
+ *            or -1 to run it as usual
+ * @returns 0 on success, -1 on error
+ */
+static int
+run_commands(struct command_list *cl, int flags, jid_t jid) {
+    size_t stage = 0; /* Position of the command in its pipeline */
     int pipeline_fds[2] = {-1, -1};
     pid_t pipeline_pgid = 0;
-    jid_t pipeline_jid = -1;
+    jid_t pipeline_jid = -1; /* Once the pipeline has a job, queued or started */
 
     for (size_t i = 0; i < cl->command_count; ++i) {
         struct command *cmd = cl->commands[i];
-        expand_command_words(cmd);
+        if (jid < 0) expand_command_words(cmd);
 
         // 3 control types:
         // ';' -- foreground command, parent waits sychronously for child process
@@ -304,16 +1415,38 @@ run_command_list(struct command_list *cl) {
         // execution environment (not as children) in order to modify it. For
         // example to change the shell's working directory, exit the shell, and so
         // on.
+        //
+        // A command feeding a fan-out group writes to a pipe like a pipeline
+        // command, while its ctrl_op tells how the group as a whole is waited on.
 
         int const is_pl = cmd->ctrl_op == '|'; /* pipeline */
         int const is_bg = cmd->ctrl_op == '&'; /* background */
         int const is_fg = cmd->ctrl_op == ';'; /* foreground */
         assert(is_pl || is_bg || is_fg);
 
+        /* A background pipeline beyond the job limit waits its turn. Once
+         * some are waiting, later ones queue behind them. */
+        if (jid < 0 && pipeline_fds[STDIN_FILENO] < 0 && !is_fg) {
+            size_t last = i;
+            while (cl->commands[last]->ctrl_op == '|') ++last;
+            size_t const limit = max_jobs();
+            if (cl->commands[last]->ctrl_op == '&' && limit &&
+                (jobs_count_active() >= limit || queue_head < queue_count)) {
+                jid_t const queued = queue_pipeline(cl, i, last);
+                if (queued < 0) goto err;
+                fprintf(stderr, "[%jd] queued\n", (intmax_t) queued);
+                params.status = 0;
+                i = last;
+                continue;
+            }
+        }
+
         int stdin_override = pipeline_fds[STDIN_FILENO];
+        stage = stdin_override < 0 ? 0 : stage + 1;
+        if (stage == 0) pipeline_jid = jid;
 
-        if (is_pl) {
-            if (pipe(pipeline_fds) == -1) err(1, 0);
+        if (is_pl || cmd->fanout_count) {
+            if (pipe_open(pipeline_fds) == -1) err(1, 0);
         } else {
             pipeline_fds[0] = -1;
             pipeline_fds[1] = -1;
@@ -321,85 +1454,107 @@ run_command_list(struct command_list *cl) {
 
         int stdout_override = pipeline_fds[STDOUT_FILENO];
 
-        builtin_fn builtin = get_builtin(cmd);
+        struct prefixes prefix;
+        strip_prefixes(cmd, &prefix);
 
-        pid_t child_pid = 0;
+        builtin_fn builtin = get_builtin(cmd);
 
-        if (builtin == NULL || !is_fg) {
-            if ((child_pid = fork()) == -1) err(1, 0);
+        if (builtin && is_pl && !prefix.child && !cmd->fanout_count && !cmd->workers &&
+            cmd->assignment_count == 0 && (builtin_flags(builtin) & BUILTIN_PURE)) {
+            /* Nothing a subshell would need to protect; skip the fork */
+            int const result =
+                    run_builtin_stage(cmd, builtin, stdin_override, stdout_override, pipeline_fds[STDIN_FILENO]);
+            /* Its status is kept in the job like a child's; a first stage
+             * queues the job, which its first child starts */
+            if (pipeline_jid < 0 && (pipeline_jid = jobs_add_queued()) < 0) goto err;
+            if (jobs_add_done(pipeline_jid, cmd->words[0], W_EXITCODE(result < 0 ? 127 : result, 0)) < 0) {
+                goto err;
+            }
+            if (prefix.time) jobs_set_measured(pipeline_jid, prefix.time);
+            errno = 0;
+            continue;
         }
 
-        if (child_pid == 0) {
-            if (builtin) {
-                struct builtin_redir *redir_list = 0;
-
-                if (stdin_override >= 0) {
-                    struct builtin_redir *rec = malloc(sizeof *rec);
-                    if (!rec) goto err;
-                    rec->pseudofd = STDIN_FILENO;
-                    rec->realfd = stdin_override;
-                    rec->next = redir_list;
-                    redir_list = rec;
-                }
-                if (stdout_override >= 0) {
-                    struct builtin_redir *rec = malloc(sizeof *rec);
-                    if (!rec) goto err;
-                    rec->pseudofd = STDOUT_FILENO;
-                    rec->realfd = stdout_override;
-                    rec->next = redir_list;
-                    redir_list = rec;
-                }
-
-                do_builtin_io_redirects(cmd, &redir_list);
-
-                do_variable_assignment(cmd, 0);
-
-                int result = builtin(cmd, redir_list);
-
-                while (redir_list) {
-                    close(redir_list->realfd);
-                    void *tmp = redir_list;
-                    redir_list = redir_list->next;
-                    free(tmp);
-                }
-
-                params.status = result ? 127 : 0;
-                if (!is_fg) exit(params.status);
-
-                errno = 0;
-                continue;
-            } else {
-                if (stdin_override >= 0) {
-                    if (move_fd(stdin_override, STDIN_FILENO) == -1) err(1, 0);
-                }
-
-                if (stdout_override >= 0) {
-                    if (move_fd(stdout_override, STDOUT_FILENO) == -1) err(1, 0);
-                }
-
-                if (do_io_redirects(cmd) < 0) err(1, 0);
+        /* The last stage of a pipeline runs in the shell too, except for
+         * exec, which would replace the shell or take over its stdin */
+        if (builtin && is_fg && !prefix.child && !cmd->fanout_count && !cmd->workers &&
+            !(builtin_flags(builtin) & BUILTIN_SUBSHELL) &&
+            !(stdin_override >= 0 && (builtin_flags(builtin) & BUILTIN_SHELL_REDIRS))) {
+            struct timing_self timing;
+            if (prefix.time) timing_self_begin(&timing);
+            int result = run_builtin(cmd, builtin, stdin_override, stdout_override);
+            /* Earlier stages are waited for as a foreground job would be,
+             * but the status is still the last stage's */
+            if (pipeline_pgid) {
+                if (wait_on_fg_gid(pipeline_pgid) < 0) warn(0);
+            } else if (jid < 0 && pipeline_jid >= 0) {
+                jobs_remove(pipeline_jid);
+            }
+            pipeline_pgid = 0;
+            pipeline_jid = -1;
+            params.status = result < 0 ? 127 : result;
+            if (prefix.time) timing_self_end(&timing, prefix.time, cmd->words[0], params.status);
+            errno = 0;
+            continue;
+        }
 
-                if (do_variable_assignment(cmd, 1) < 0) err(1, 0);
+        /* Everything from here on runs in a child */
+        placement_from_vars(cmd, stage, &prefix.place);
 
-                if (signal_restore() < 0) err(1, 0);
+        if ((flags & RUN_TAIL_EXEC) && i + 1 == cl->command_count && is_fg && !builtin &&
+            !prefix.timeout && !prefix.time && stdin_override < 0 && !cmd->fanout_count && !cmd->workers &&
+            jobs_count() == 0) {
+            /* The shell would only wait for this command and exit with its
+             * status; let the command take over the process instead */
+            fflush(0);
+            stats_add(STATS_EXECS, 1);
+            stats_dump();
+            if (placement_apply(&prefix.place) < 0) warn("%s", cmd->words[0]);
+            run_child(cmd, 0, command_path(cmd, 0), -1, -1);
+        }
 
-                execvp(cmd->words[0], cmd->words);
+        /* Identified now: the shell's end is closed once the stage starts */
+        struct stat pipe_st;
+        int const watch = is_pl && jid < 0 && pipe_adaptive() && fstat(stdout_override, &pipe_st) == 0;
 
-                err(127, 0);
-                assert(0);
-            }
-        }
-        assert(child_pid > 0);
-        if (stdout_override >= 0) close(stdout_override);
-        if (stdin_override >= 0) close(stdin_override);
+        pid_t child_pid = spawn_stage(cmd,
+                                      builtin,
+                                      stdin_override,
+                                      stdout_override,
+                                      pipeline_fds[STDIN_FILENO],
+                                      pipeline_pgid,
+                                      &prefix.place);
+        if (child_pid < 0) goto err;
 
-        if (setpgid(child_pid, pipeline_pgid) < 0) goto err;
         if (pipeline_pgid == 0) {
             /* Start of a new pipeline */
             assert(child_pid == getpgid(child_pid));
             pipeline_pgid = child_pid;
-            pipeline_jid = jobs_add(pipeline_pgid);
-            if (pipeline_jid < 0) goto err;
+            if (pipeline_jid >= 0) {
+                if (jobs_start(pipeline_jid, pipeline_pgid) < 0) goto err;
+            } else {
+                pipeline_jid = jobs_add(pipeline_pgid);
+                if (pipeline_jid < 0) goto err;
+            }
+            if (jid < 0) pipe_watch_reset();
+        } else if (jobs_add_process(pipeline_jid, child_pid) < 0) {
+            goto err;
+        }
+        /* The job's status is its last stage's */
+        if (!is_pl && jobs_set_last(pipeline_jid, child_pid) < 0) goto err;
+
+        if (prefix.timeout &&
+            timers_add(pipeline_jid, prefix.sig, prefix.after, prefix.kill_after) < 0) {
+            goto err;
+        }
+        if (prefix.time) jobs_set_measured(pipeline_jid, prefix.time);
+
+        if (watch && pipe_watch(child_pid, &pipe_st) < 0) goto err;
+
+        if (cmd->fanout_count) {
+            if (spawn_fanout(cmd, pipeline_fds[STDIN_FILENO], pipeline_pgid) < 0) goto err;
+            pipeline_fds[0] = -1;
+            pipeline_fds[1] = -1;
         }
 
         if (is_fg) {
@@ -408,6 +1563,8 @@ run_command_list(struct command_list *cl) {
                 params.status = 127;
                 return -1;
             }
+        } else if (jid >= 0) {
+            /* Started from the queue; announced when it was queued */
         } else {
             params.bg_pid = child_pid;
 
@@ -426,10 +1583,13 @@ run_command_list(struct command_list *cl) {
 
         if (!is_pl) {
             pipeline_pgid = 0;
+            pipeline_jid = -1;
         }
     }
 
     return 0;
     err:
+    /* A job queued for builtin stages alone never started */
+    if (jid < 0 && jobs_get_state(pipeline_jid) == JOB_QUEUED) jobs_remove(pipeline_jid);
     return -1;
 }
@@ -2,8 +2,42 @@
 
 #include "parser.h"
 
+/* run_command_list flags */
+enum {
+    /* No input follows this command list, and nothing depends on the shell
+     * after it: a simple external command at the end may replace the shell
+     * rather than run in a child */
+    RUN_TAIL_EXEC = 1 << 0,
+};
+
 /** Exactly what it sounds like
  *
+ * @param flags RUN_* flags
  * @returns 0 on success, -1 on error
+ *
+ * While $MS_MAX_JOBS (a positive count) background jobs are running or
+ * stopped, further background pipelines are expanded and queued instead of
+ * started, and listed by `jobs` as queued. run_queued() starts them as
+ * others finish. Commands queued are moved out of cl.
+ */
+extern int run_command_list(struct command_list *cl, int flags);
+
+/** Starts queued background pipelines while there's room under $MS_MAX_JOBS
+ *
+ * @param exempt number of active jobs not to count against the limit, i.e.
+ *               a job running in the foreground
+ *
+ * Called as children are reaped; failures to start are reported, and drop
+ * the job.
  */
-extern int run_command_list(struct command_list *cl);
+extern void run_queued(size_t exempt);
+
+/** Drops queued background pipelines without starting them
+ *
+ * Done when the shell exits, and in forked children, which must not start
+ * the shell's jobs.
+ */
+extern void runner_cleanup(void);
+
+/** Gets the open() flags for a redirection operator */
+extern int get_io_flags(enum io_operator io_op);
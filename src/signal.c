@@ -3,6 +3,7 @@
 #include <signal.h>
 #include <stddef.h>
 
+#include "probes.h"
 #include "signal.h"
 
 static void
@@ -10,6 +11,7 @@ interrupting_signal_handler(int signo) {
     /* Its only job is to interrupt system calls--like read()--when
      * certain signals arrive--like Ctrl-C.
      */
+    PROBE1(signal_interrupt, signo);
 }
 
 static struct sigaction ignore_action = {.sa_handler = SIG_IGN};
@@ -17,6 +19,8 @@ static struct sigaction interrupt_action = {.sa_handler = interrupting_signal_ha
 static struct sigaction old_sigtstp;
 static struct sigaction old_sigint;
 static struct sigaction old_sigttou;
+static struct sigaction old_sigpipe;
+static sigset_t old_mask;
 
 /* Ignore certain signals.
  * 
@@ -27,16 +31,26 @@ static struct sigaction old_sigttou;
  *   - SIGTSTP
  *   - SIGINT
  *   - SIGTTOU
+ *   - SIGPIPE (builtins may write to pipes from within the shell)
+ *
+ * SIGCHLD is blocked; child events are read from a signalfd instead (see
+ * wait.c).
  *
  * Should be called immediately on entry to main() 
  *
- * Saves old signal dispositions for a later call to signal_restore()
+ * Saves old signal dispositions and mask for a later call to signal_restore()
  */
 int
 signal_init(void) {
+    sigset_t sigchld;
+    sigemptyset(&sigchld);
+    sigaddset(&sigchld, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &sigchld, &old_mask) != 0) return -1;
+
     if (sigaction(SIGTSTP, &ignore_action, &old_sigtstp) != 0) return -1;
     if (sigaction(SIGINT, &ignore_action, &old_sigint) != 0) return -1;
     if (sigaction(SIGTTOU, &ignore_action, &old_sigttou) != 0) return -1;
+    if (sigaction(SIGPIPE, &ignore_action, &old_sigpipe) != 0) return -1;
     return 0;
 }
 
@@ -64,7 +78,7 @@ signal_ignore(int sig) {
     return 0;
 }
 
-/** Restores signal dispositions to what they were when shell was invoked
+/** Restores signal dispositions and mask to what they were when shell was invoked
  *
  * @returns 0 on success, -1 on failure
  *
@@ -74,5 +88,30 @@ signal_restore(void) {
     if (sigaction(SIGTSTP, &old_sigtstp, NULL) != 0) return -1;
     if (sigaction(SIGINT, &old_sigint, NULL) != 0) return -1;
     if (sigaction(SIGTTOU, &old_sigttou, NULL) != 0) return -1;
+    if (sigaction(SIGPIPE, &old_sigpipe, NULL) != 0) return -1;
+    if (sigprocmask(SIG_SETMASK, &old_mask, NULL) != 0) return -1;
     return 0;
 }
+
+/** Gets the signal mask signal_restore() would restore */
+void
+signal_saved_mask(sigset_t *mask) {
+    *mask = old_mask;
+}
+
+/** Gets the signals signal_restore() would return to their default action
+ *
+ * @param [out]set the signals
+ *
+ * For posix_spawn(), which can reset signals to their default action, but not
+ * restore arbitrary dispositions. Dispositions the shell inherited as ignored
+ * stay ignored either way, and handlers never survive exec.
+ */
+void
+signal_default_set(sigset_t *set) {
+    sigemptyset(set);
+    if (old_sigtstp.sa_handler == SIG_DFL) sigaddset(set, SIGTSTP);
+    if (old_sigint.sa_handler == SIG_DFL) sigaddset(set, SIGINT);
+    if (old_sigttou.sa_handler == SIG_DFL) sigaddset(set, SIGTTOU);
+    if (old_sigpipe.sa_handler == SIG_DFL) sigaddset(set, SIGPIPE);
+}
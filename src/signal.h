@@ -1,5 +1,10 @@
 #pragma once
+
+#include <signal.h>
+
 extern int signal_init(void);
 extern int signal_enable_interrupt(int sig);
 extern int signal_ignore(int sig);
 extern int signal_restore(void);
+extern void signal_default_set(sigset_t *set);
+extern void signal_saved_mask(sigset_t *mask);
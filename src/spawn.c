@@ -0,0 +1,259 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pathcache.h"
+#include "probes.h"
+#include "runner.h"
+#include "signal.h"
+#include "spawn.h"
+#include "stats.h"
+#include "trace.h"
+#include "util/asprintf.h"
+
+extern char **environ;
+
+/* Files opened for redirections are parked at or above this fd until the
+ * child moves them into place, clear of the fds being redirected */
+enum { PARK_FD_MIN = 100 };
+
+/* One step of the child's fd setup; src -1 closes dst */
+struct fd_action {
+    int src;
+    int dst;
+};
+
+/** Finds a command's executable
+ *
+ * @returns the path (to be freed), or null pointer if not found
+ */
+static char *
+find_command(char const *name) {
+    if (strchr(name, '/')) return strdup(name);
+    char const *path = pathcache_lookup(name);
+    return path ? strdup(path) : 0;
+}
+
+char **
+spawn_env(struct command const *cmd, char **owned) {
+    size_t n = 0;
+    while (environ[n]) ++n;
+    char **env = malloc(sizeof *env * (n + cmd->assignment_count + 1));
+    if (!env) return 0;
+    memcpy(env, environ, sizeof *env * n);
+
+    for (size_t i = 0; i < cmd->assignment_count; ++i) {
+        struct assignment const *a = cmd->assignments[i];
+        if (asprintf(&owned[i], "%s=%s", a->name, a->value) < 0) {
+            while (i) free(owned[--i]);
+            free(env);
+            return 0;
+        }
+        size_t const len = strlen(a->name);
+        size_t j = 0;
+        while (j < n && !(strncmp(env[j], a->name, len) == 0 && env[j][len] == '=')) ++j;
+        env[j] = owned[i];
+        if (j == n) ++n;
+    }
+    env[n] = 0;
+    return env;
+}
+
+/** Starts a child that reports an error and exits, in place of a command
+ *
+ * The fd actions performed so far are replayed first, so the message goes
+ * wherever the command's stderr would have.
+ */
+static pid_t
+spawn_failure(int error, int status, struct fd_action const *actions, size_t n, pid_t pgid) {
+    stats_add(STATS_FORKS, 1);
+    pid_t pid = fork();
+    if (pid == 0) {
+        setpgid(0, pgid);
+        for (size_t i = 0; i < n; ++i) {
+            if (actions[i].src < 0) close(actions[i].dst);
+            else dup2(actions[i].src, actions[i].dst);
+        }
+        errno = error;
+        err(status, 0);
+    }
+    if (pid > 0 && setpgid(pid, pgid) < 0 && errno != EACCES) return -1;
+    errno = 0;
+    return pid;
+}
+
+/** posix_spawn(), counted */
+static int
+counted_spawn(pid_t *pid,
+              char const *path,
+              posix_spawn_file_actions_t const *file_actions,
+              posix_spawnattr_t const *attr,
+              char *const argv[],
+              char *const env[]) {
+    stats_add(STATS_SPAWNS, 1);
+    return posix_spawn(pid, path, file_actions, attr, argv, env);
+}
+
+/** Checks if a redirection source fd will be open in the child */
+static int
+fd_is_open(int fd, struct fd_action const *actions, size_t n) {
+    for (size_t i = n; i-- > 0;) {
+        if (actions[i].dst == fd) return actions[i].src >= 0;
+    }
+    return fcntl(fd, F_GETFD) >= 0;
+}
+
+pid_t
+spawn_external(struct command const *cmd, int stdin_fd, int stdout_fd, pid_t pgid) {
+    pid_t pid = 0;
+    char *path = 0;
+    char **env = 0;
+    char **owned = 0;
+    struct fd_action *actions = 0;
+    size_t action_count = 0;
+    int *parked = 0;
+    size_t parked_count = 0;
+    posix_spawn_file_actions_t file_actions;
+    posix_spawnattr_t attr;
+    int have_file_actions = 0;
+    int have_attr = 0;
+
+    /* Commands fork doesn't reproduce the behaviour of exactly */
+    for (size_t i = 0; i < cmd->assignment_count; ++i) {
+        if (strcmp(cmd->assignments[i]->name, "PATH") == 0) return 0;
+    }
+    for (size_t i = 0; i < cmd->io_redir_count; ++i) {
+        struct io_redir const *r = cmd->io_redirs[i];
+        if (r->io_number >= PARK_FD_MIN) return 0;
+
+        /* n>&m from where files are parked, which the parking could clobber */
+        if (r->io_op == OP_GREATAND || r->io_op == OP_LESSAND) {
+            char *end = r->filename;
+            long src = strtol(r->filename, &end, 10);
+            if (*r->filename && !*end && src >= PARK_FD_MIN) return 0;
+        }
+    }
+    path = find_command(cmd->words[0]);
+    if (!path) return 0; /* Let the child report it */
+
+    owned = calloc(cmd->assignment_count + 1, sizeof *owned);
+    actions = malloc(sizeof *actions * (cmd->io_redir_count + 2));
+    parked = malloc(sizeof *parked * (cmd->io_redir_count + 1));
+    if (!owned || !actions || !parked) goto err;
+    env = spawn_env(cmd, owned);
+    if (!env) goto err;
+
+    if (stdin_fd >= 0) actions[action_count++] = (struct fd_action) {stdin_fd, STDIN_FILENO};
+    if (stdout_fd >= 0) actions[action_count++] = (struct fd_action) {stdout_fd, STDOUT_FILENO};
+
+    /* Same steps as do_io_redirects, with files opened here */
+    for (size_t i = 0; i < cmd->io_redir_count; ++i) {
+        struct io_redir const *r = cmd->io_redirs[i];
+        if (r->io_op == OP_GREATAND || r->io_op == OP_LESSAND) {
+            if (strcmp(r->filename, "-") == 0) {
+                actions[action_count++] = (struct fd_action) {-1, r->io_number};
+                continue;
+            }
+            char *end = r->filename;
+            long src = strtol(r->filename, &end, 10);
+            if (*r->filename && !*end && src >= 0) {
+                if (!fd_is_open((int) src, actions, action_count)) {
+                    pid = spawn_failure(EBADF, 1, actions, action_count, pgid);
+                    goto out;
+                }
+                actions[action_count++] = (struct fd_action) {(int) src, r->io_number};
+                continue;
+            }
+        }
+        int fd = open(r->filename, get_io_flags(r->io_op) | O_CLOEXEC, 0777);
+        if (fd >= 0) {
+            int high = fcntl(fd, F_DUPFD_CLOEXEC, PARK_FD_MIN);
+            close(fd);
+            fd = high;
+        }
+        if (fd < 0) {
+            pid = spawn_failure(errno, 1, actions, action_count, pgid);
+            goto out;
+        }
+        parked[parked_count++] = fd;
+        actions[action_count++] = (struct fd_action) {fd, r->io_number};
+    }
+
+    if (posix_spawn_file_actions_init(&file_actions) != 0) goto err;
+    have_file_actions = 1;
+    for (size_t i = 0; i < action_count; ++i) {
+        int res = actions[i].src < 0
+                  ? posix_spawn_file_actions_addclose(&file_actions, actions[i].dst)
+                  : posix_spawn_file_actions_adddup2(&file_actions, actions[i].src, actions[i].dst);
+        if (res != 0) {
+            errno = res;
+            goto err;
+        }
+    }
+
+    sigset_t sigdefault, sigmask;
+    signal_default_set(&sigdefault);
+    signal_saved_mask(&sigmask);
+    if (posix_spawnattr_init(&attr) != 0) goto err;
+    have_attr = 1;
+    if (posix_spawnattr_setflags(&attr,
+                                 POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF |
+                                 POSIX_SPAWN_SETSIGMASK) != 0 ||
+        posix_spawnattr_setpgroup(&attr, pgid) != 0 ||
+        posix_spawnattr_setsigdefault(&attr, &sigdefault) != 0 ||
+        posix_spawnattr_setsigmask(&attr, &sigmask) != 0) {
+        goto err;
+    }
+
+    int64_t const start = PROBE_ENABLED(spawn) || trace_buffer ? probe_now() : 0;
+    int res = counted_spawn(&pid, path, &file_actions, &attr, cmd->words, env);
+    if (res == ENOENT && !strchr(cmd->words[0], '/')) {
+        /* Moved or removed since it was cached */
+        pathcache_forget(cmd->words[0]);
+        free(path);
+        path = find_command(cmd->words[0]);
+        if (path) res = counted_spawn(&pid, path, &file_actions, &attr, cmd->words, env);
+    }
+    if (res == ENOEXEC) {
+        /* Not a binary: run it as a script, as execvp() would */
+        char **argv = malloc(sizeof *argv * (cmd->word_count + 2));
+        if (!argv) goto err;
+        argv[0] = "sh";
+        argv[1] = path;
+        memcpy(&argv[2], &cmd->words[1], sizeof *argv * cmd->word_count);
+        res = counted_spawn(&pid, "/bin/sh", &file_actions, &attr, argv, env);
+        free(argv);
+    }
+    if (res == 0) {
+        stats_add(STATS_EXECS, 1);
+        int64_t const ns = start ? probe_now() - start : 0;
+        PROBE4(spawn, pid, pgid ? pgid : pid, path, ns);
+        trace_event(TRACE_EXEC, pid, pgid ? pgid : pid, (uint64_t) ns, cmd->words[0]);
+    } else {
+        pid = spawn_failure(res, 127, actions, action_count, pgid);
+    }
+    goto out;
+
+    err:
+    pid = -1;
+    out:
+    if (have_attr) posix_spawnattr_destroy(&attr);
+    if (have_file_actions) posix_spawn_file_actions_destroy(&file_actions);
+    while (parked_count) close(parked[--parked_count]);
+    for (size_t i = 0; owned && i < cmd->assignment_count; ++i) free(owned[i]);
+    free(owned);
+    free(env);
+    free(parked);
+    free(actions);
+    free(path);
+    return pid;
+}
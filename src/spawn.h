@@ -0,0 +1,38 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include "parser.h"
+
+/** Starts an external command with posix_spawn() instead of fork()
+ *
+ * @param stdin_fd  pipe to use as stdin, or -1
+ * @param stdout_fd pipe to use as stdout, or -1
+ * @param pgid      process group to place the child in, or 0 to start a new one
+ * @returns the child's pid
+ * @returns 0 if the command has to be forked instead; nothing was done
+ * @returns -1 on failure
+ *
+ * Redirections, pipeline fds, the process group, signal dispositions and
+ * assignments are all translated into spawn attributes and file actions, so
+ * the child behaves as if forked and set up by the runner. Spawning doesn't
+ * copy the shell's page tables, so it stays cheap as the shell grows.
+ *
+ * Redirection files are opened in the shell, so errors are found before
+ * anything is spawned; such commands are left to fork, which reports them.
+ * So are redirections to or from descriptors 100 and up, where those files
+ * are parked until the child takes them.
+ * If the exec itself fails, a child exiting with status 127 stands in for the
+ * command.
+ */
+extern pid_t spawn_external(struct command const *cmd, int stdin_fd, int stdout_fd, pid_t pgid);
+
+/** Builds the environment for a command: the shell's, plus its assignments
+ *
+ * @param [out]owned receives the strings allocated here, one per assignment
+ * @returns the environment (to be freed), or null pointer on failure
+ *
+ * The shell's own environment is left alone, so nothing needs undoing if the
+ * command can't be run.
+ */
+extern char **spawn_env(struct command const *cmd, char **owned);
@@ -0,0 +1,179 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "stats.h"
+#include "util/alloc.h"
+#include "vars.h"
+
+uint64_t stats_counters[STATS_COUNTER_COUNT] = {0};
+
+static struct {
+    uint64_t calls;
+    uint64_t ns;
+} timers[STATS_TIMER_COUNT] = {{0}};
+
+static char const *const counter_names[STATS_COUNTER_COUNT] = {
+        [STATS_FORKS] = "forks",
+        [STATS_SPAWNS] = "spawns",
+        [STATS_EXECS] = "execs",
+        [STATS_BUILTINS] = "builtins",
+        [STATS_PATH_HITS] = "path_hits",
+        [STATS_PATH_MISSES] = "path_misses",
+        [STATS_BYTES_PARSED] = "bytes_parsed",
+        [STATS_ALLOCS] = "allocs",
+        [STATS_FREES] = "frees",
+        [STATS_PEAK_JOBS] = "peak_jobs",
+};
+
+static char const *const timer_names[STATS_TIMER_COUNT] = {
+        [STATS_PARSE] = "parse",
+        [STATS_EXPAND] = "expand",
+        [STATS_RUN] = "run",
+        [STATS_WAIT_FG] = "wait_fg",
+};
+
+/* Allocations are counted by standing in for glibc's allocator entry points,
+ * which forward to its own. The counters are atomic, in case anything
+ * allocates off the main thread. */
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *
+malloc(size_t size) {
+    __atomic_fetch_add(&stats_counters[STATS_ALLOCS], 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t n, size_t size) {
+    __atomic_fetch_add(&stats_counters[STATS_ALLOCS], 1, __ATOMIC_RELAXED);
+    return __libc_calloc(n, size);
+}
+
+void *
+realloc(void *ptr, size_t size) {
+    __atomic_fetch_add(&stats_counters[STATS_ALLOCS], 1, __ATOMIC_RELAXED);
+    void *p = __libc_realloc(ptr, size);
+#ifdef ALLOC_ACCOUNTING
+    if (ptr && (p || size == 0)) alloc_moved(ptr, p, size);
+#endif
+    return p;
+}
+
+void
+free(void *ptr) {
+    if (ptr) {
+        __atomic_fetch_add(&stats_counters[STATS_FREES], 1, __ATOMIC_RELAXED);
+#ifdef ALLOC_ACCOUNTING
+        alloc_freed(ptr);
+#endif
+    }
+    __libc_free(ptr);
+}
+#endif
+
+/* When the shell started, for its uptime */
+static struct timespec started;
+
+__attribute__((constructor)) static void
+stats_init(void) {
+    clock_gettime(CLOCK_MONOTONIC, &started);
+}
+
+static uint64_t
+elapsed_ns(struct timespec start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) (now.tv_sec - start.tv_sec) * 1000000000u + now.tv_nsec - start.tv_nsec;
+}
+
+struct timespec
+stats_begin(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now;
+}
+
+uint64_t
+stats_end(enum stats_timer t, struct timespec start) {
+    uint64_t const ns = elapsed_ns(start);
+    timers[t].ns += ns;
+    ++timers[t].calls;
+    return ns;
+}
+
+static double
+tv_secs(struct timeval tv) {
+    return (double) tv.tv_sec + (double) tv.tv_usec / 1e6;
+}
+
+int
+stats_print(int fd, int json) {
+    struct rusage self;
+    struct rusage children;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+    double const uptime = (double) elapsed_ns(started) / 1e9;
+
+    /* Counters are copied first, so printing's own allocations don't show */
+    uint64_t counters[STATS_COUNTER_COUNT];
+    for (size_t i = 0; i < STATS_COUNTER_COUNT; ++i) {
+        counters[i] = __atomic_load_n(&stats_counters[i], __ATOMIC_RELAXED);
+    }
+
+    FILE *f = fdopen(dup(fd), "w");
+    if (!f) return -1;
+    if (json) {
+        fprintf(f, "{\"pid\":%ld,\"uptime\":%.6f", (long) getpid(), uptime);
+        for (size_t i = 0; i < STATS_COUNTER_COUNT; ++i) {
+            fprintf(f, ",\"%s\":%llu", counter_names[i], (unsigned long long) counters[i]);
+        }
+        for (size_t i = 0; i < STATS_TIMER_COUNT; ++i) {
+            fprintf(f,
+                    ",\"%s\":{\"calls\":%llu,\"seconds\":%.6f}",
+                    timer_names[i],
+                    (unsigned long long) timers[i].calls,
+                    (double) timers[i].ns / 1e9);
+        }
+        fprintf(f,
+                ",\"shell_user\":%.6f,\"shell_sys\":%.6f"
+                ",\"children_user\":%.6f,\"children_sys\":%.6f}\n",
+                tv_secs(self.ru_utime), tv_secs(self.ru_stime),
+                tv_secs(children.ru_utime), tv_secs(children.ru_stime));
+    } else {
+        fprintf(f, "%-14s %12.6fs\n", "uptime", uptime);
+        for (size_t i = 0; i < STATS_COUNTER_COUNT; ++i) {
+            fprintf(f, "%-14s %12llu\n", counter_names[i], (unsigned long long) counters[i]);
+        }
+        for (size_t i = 0; i < STATS_TIMER_COUNT; ++i) {
+            fprintf(f,
+                    "%-14s %12.6fs in %llu calls\n",
+                    timer_names[i],
+                    (double) timers[i].ns / 1e9,
+                    (unsigned long long) timers[i].calls);
+        }
+        fprintf(f,
+                "%-14s %12.6fs user %.6fs sys\n%-14s %12.6fs user %.6fs sys\n",
+                "shell", tv_secs(self.ru_utime), tv_secs(self.ru_stime),
+                "children", tv_secs(children.ru_utime), tv_secs(children.ru_stime));
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+void
+stats_dump(void) {
+    char const *path = vars_get("MS_STATS_FILE");
+    if (!path || !*path) return;
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    if (fd < 0) return;
+    stats_print(fd, 1);
+    close(fd);
+}
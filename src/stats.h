@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+/* Events the shell counts, always */
+enum stats_counter {
+    STATS_FORKS,        /* fork() calls by the shell */
+    STATS_SPAWNS,       /* posix_spawn() calls by the shell */
+    STATS_EXECS,        /* External commands started, however */
+    STATS_BUILTINS,     /* Builtins run, in the shell or in a child */
+    STATS_PATH_HITS,    /* PATH lookups answered by the cache */
+    STATS_PATH_MISSES,  /* PATH lookups that searched the directories */
+    STATS_BYTES_PARSED, /* Input read by the parser */
+    STATS_ALLOCS,       /* malloc(), calloc() and realloc() calls */
+    STATS_FREES,        /* free() calls */
+    STATS_PEAK_JOBS,    /* Most jobs in the job table at once */
+    STATS_COUNTER_COUNT,
+};
+
+/* Parts of the shell whose time is measured; each includes the time of any
+ * it calls, e.g. run includes wait_fg */
+enum stats_timer {
+    STATS_PARSE,   /* command_list_parse(), reading input included */
+    STATS_EXPAND,  /* expand_command_words() */
+    STATS_RUN,     /* run_command_list() */
+    STATS_WAIT_FG, /* wait_on_fg_gid(): waiting on foreground jobs */
+    STATS_TIMER_COUNT,
+};
+
+extern uint64_t stats_counters[STATS_COUNTER_COUNT];
+
+/** Counts an event */
+static inline void
+stats_add(enum stats_counter c, uint64_t n) {
+    stats_counters[c] += n;
+}
+
+/** Raises a high-water mark */
+static inline void
+stats_max(enum stats_counter c, uint64_t n) {
+    if (n > stats_counters[c]) stats_counters[c] = n;
+}
+
+/** Starts timing a call
+ *
+ * @returns the time now, to hand to stats_end()
+ */
+extern struct timespec stats_begin(void);
+
+/** Finishes timing a call started with stats_begin()
+ *
+ * @returns the time it took, in nanoseconds
+ */
+extern uint64_t stats_end(enum stats_timer t, struct timespec start);
+
+/** Prints the counters and timers, with the shell's and its children's CPU
+ *  time, as text or as one line of JSON
+ *
+ * @returns 0 on success, -1 on failure
+ */
+extern int stats_print(int fd, int json);
+
+/** Appends the stats as JSON to $MS_STATS_FILE, if set
+ *
+ * Done when the shell exits, or replaces itself with a command.
+ */
+extern void stats_dump(void);
@@ -0,0 +1,206 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "jobs.h"
+#include "timers.h"
+#include "wait.h"
+
+/* Timeouts are kept in a binary min-heap by deadline; the timerfd is armed
+ * for the root only, so any number of them cost one fd and one wakeup per
+ * expiry. */
+static struct timeout {
+    struct timespec deadline; /* CLOCK_MONOTONIC */
+    jid_t jid;
+    pid_t pgid;
+    int sig;
+    struct timespec kill_after; /* Zero if no SIGKILL follows */
+} *heap = 0;
+static size_t heap_count = 0;
+static size_t heap_cap = 0;
+
+static int timer_fd = -1;
+
+static int
+ts_before(struct timespec a, struct timespec b) {
+    return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+static struct timespec
+ts_add(struct timespec a, struct timespec b) {
+    a.tv_sec += b.tv_sec;
+    a.tv_nsec += b.tv_nsec;
+    if (a.tv_nsec >= 1000000000L) {
+        a.tv_nsec -= 1000000000L;
+        ++a.tv_sec;
+    }
+    return a;
+}
+
+static void
+swap(size_t i, size_t j) {
+    struct timeout tmp = heap[i];
+    heap[i] = heap[j];
+    heap[j] = tmp;
+}
+
+static void
+sift_up(size_t i) {
+    while (i > 0 && ts_before(heap[i].deadline, heap[(i - 1) / 2].deadline)) {
+        swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void
+sift_down(size_t i) {
+    for (;;) {
+        size_t min = i;
+        size_t const l = 2 * i + 1;
+        size_t const r = l + 1;
+        if (l < heap_count && ts_before(heap[l].deadline, heap[min].deadline)) min = l;
+        if (r < heap_count && ts_before(heap[r].deadline, heap[min].deadline)) min = r;
+        if (min == i) return;
+        swap(i, min);
+        i = min;
+    }
+}
+
+static int
+push(struct timeout t) {
+    if (heap_count == heap_cap) {
+        size_t const cap = heap_cap ? heap_cap * 2 : 16;
+        void *tmp = realloc(heap, sizeof *heap * cap);
+        if (!tmp) return -1;
+        heap = tmp;
+        heap_cap = cap;
+    }
+    heap[heap_count] = t;
+    sift_up(heap_count++);
+    return 0;
+}
+
+static struct timeout
+pop(void) {
+    struct timeout t = heap[0];
+    heap[0] = heap[--heap_count];
+    sift_down(0);
+    return t;
+}
+
+/** Arms the timerfd for the earliest deadline, or disarms it */
+static int
+rearm(void) {
+    struct itimerspec its = {0};
+    if (heap_count) its.it_value = heap[0].deadline;
+    return timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, 0);
+}
+
+int
+timers_parse_duration(char const *s, struct timespec *ts) {
+    char *end = 0;
+    double secs = strtod(s, &end);
+    if (end == s || !isfinite(secs) || secs < 0) return -1;
+    switch (*end) {
+        case 'd':
+            secs *= 24;
+            /* fall through */
+        case 'h':
+            secs *= 60;
+            /* fall through */
+        case 'm':
+            secs *= 60;
+            /* fall through */
+        case 's':
+            ++end;
+            break;
+    }
+    if (*end || secs > (double) INT32_MAX) return -1;
+    ts->tv_sec = (time_t) secs;
+    ts->tv_nsec = (long) ((secs - (double) ts->tv_sec) * 1e9);
+    return 0;
+}
+
+/* The timeouts belong to the shell's jobs, which a forked child must not
+ * signal: by the time they're due, the job table it has may be stale and the
+ * process groups reused. */
+static void
+forget_timeouts(void) {
+    free(heap);
+    heap = 0;
+    heap_count = heap_cap = 0;
+    close(timer_fd);
+    timer_fd = -1;
+}
+
+int
+timers_add(jid_t jid, int sig, struct timespec after, struct timespec kill_after) {
+    pid_t pgid = jobs_get_gid(jid);
+    if (pgid < 0) return -1;
+    if (timer_fd < 0) {
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer_fd < 0) return -1;
+
+        static int registered = 0;
+        if (!registered && pthread_atfork(0, 0, forget_timeouts) == 0) registered = 1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    struct timeout t = {
+            .deadline = ts_add(now, after),
+            .jid = jid,
+            .pgid = pgid,
+            .sig = sig,
+            .kill_after = kill_after,
+    };
+    if (push(t) < 0) return -1;
+    return rearm();
+}
+
+int
+timers_fd(void) {
+    return timer_fd;
+}
+
+int
+timers_expire(void) {
+    if (timer_fd < 0) return 0;
+    uint64_t expirations;
+    while (read(timer_fd, &expirations, sizeof expirations) > 0) continue;
+    errno = 0;
+
+    if (wait_reap() < 0) return -1;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int signalled = 0;
+    while (heap_count && !ts_before(now, heap[0].deadline)) {
+        struct timeout t = pop();
+
+        /* Jobs may have finished, and even been forgotten, since */
+        int const state = jobs_get_state(t.jid);
+        if (jobs_get_gid(t.jid) != t.pgid || state == JOB_DONE) continue;
+
+        kill(-t.pgid, t.sig);
+        if (state == JOB_STOPPED) kill(-t.pgid, SIGCONT);
+        jobs_set_timed_out(t.jid);
+        ++signalled;
+
+        if (t.kill_after.tv_sec || t.kill_after.tv_nsec) {
+            t.deadline = ts_add(now, t.kill_after);
+            t.sig = SIGKILL;
+            t.kill_after = (struct timespec) {0};
+            if (push(t) < 0) return -1;
+        }
+    }
+    if (rearm() < 0) return -1;
+    return signalled;
+}
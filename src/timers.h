@@ -0,0 +1,41 @@
+#pragma once
+
+#include <time.h>
+
+#include "jobs.h"
+
+/** Parses a duration: a decimal number of seconds, optionally followed by
+ *  s, m, h or d for seconds, minutes, hours or days
+ *
+ * @returns 0 on success, -1 if invalid
+ */
+extern int timers_parse_duration(char const *s, struct timespec *ts);
+
+/** Arms a timeout for a job
+ *
+ * @param [in]after      time from now until sig is sent to the job's
+ *                       process group
+ * @param [in]kill_after if nonzero, time from then until SIGKILL follows
+ * @returns 0 on success, -1 on failure
+ *
+ * All timeouts share one timerfd, armed for the earliest deadline. A job
+ * signalled by its timeout is marked as timed out in the job table.
+ */
+extern int timers_add(jid_t jid, int sig, struct timespec after, struct timespec kill_after);
+
+/** Gets the fd that becomes readable when a timeout is due
+ *
+ * @returns the fd, or -1 if no timeout was ever armed
+ *
+ * Anything that blocks in the shell should poll this too, and call
+ * timers_expire() when it's readable.
+ */
+extern int timers_fd(void);
+
+/** Signals the jobs whose timeouts are due, and rearms the timer
+ *
+ * @returns the number of jobs signalled, or -1 on failure
+ *
+ * Children are reaped first, so jobs that finished in time aren't signalled.
+ */
+extern int timers_expire(void);
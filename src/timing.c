@@ -0,0 +1,309 @@
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "jobs.h"
+#include "timing.h"
+#include "vars.h"
+#include "wait.h"
+
+/* What a report covers: a job's processes and their sum */
+struct totals {
+    double real;
+    double user;
+    double sys;
+    long maxrss; /* KiB; the largest of any one process */
+    long majflt;
+    long minflt;
+    long nvcsw;
+    long nivcsw;
+    struct proc_io io;
+};
+
+static double
+ts_diff(struct timespec end, struct timespec start) {
+    return (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static double
+tv_secs(struct timeval tv) {
+    return (double) tv.tv_sec + (double) tv.tv_usec / 1e6;
+}
+
+int
+timing_read_io(pid_t pid, struct proc_io *io) {
+    char path[32];
+    *io = (struct proc_io) {0};
+
+    snprintf(path, sizeof path, "/proc/%jd/comm", (intmax_t) pid);
+    FILE *f = fopen(path, "r");
+    if (f) {
+        if (fgets(io->comm, sizeof io->comm, f)) io->comm[strcspn(io->comm, "\n")] = '\0';
+        fclose(f);
+    }
+
+    snprintf(path, sizeof path, "/proc/%jd/io", (intmax_t) pid);
+    f = fopen(path, "r");
+    if (!f) return -1;
+    char key[32];
+    uint64_t val;
+    while (fscanf(f, "%31[^:]: %" SCNu64 " ", key, &val) == 2) {
+        if (strcmp(key, "rchar") == 0) io->rchar = val;
+        else if (strcmp(key, "wchar") == 0) io->wchar = val;
+        else if (strcmp(key, "read_bytes") == 0) io->read_bytes = val;
+        else if (strcmp(key, "write_bytes") == 0) io->write_bytes = val;
+    }
+    fclose(f);
+    return 0;
+}
+
+/** Works out one process's figures */
+static struct totals
+process_totals(struct process const *p) {
+    return (struct totals) {
+            .real = ts_diff(p->end, p->start),
+            .user = tv_secs(p->usage.ru_utime),
+            .sys = tv_secs(p->usage.ru_stime),
+            .maxrss = p->usage.ru_maxrss,
+            .majflt = p->usage.ru_majflt,
+            .minflt = p->usage.ru_minflt,
+            .nvcsw = p->usage.ru_nvcsw,
+            .nivcsw = p->usage.ru_nivcsw,
+            .io = p->io,
+    };
+}
+
+/** Works out a job's figures; its real time runs from its first process
+ *  starting to its last one finishing */
+static struct totals
+job_totals(struct process const *procs, size_t n) {
+    struct totals t = {0};
+    struct timespec start = procs[0].start;
+    struct timespec end = procs[0].end;
+    for (size_t i = 0; i < n; ++i) {
+        struct totals const p = process_totals(&procs[i]);
+        if (ts_diff(procs[i].start, start) < 0) start = procs[i].start;
+        if (ts_diff(procs[i].end, end) > 0) end = procs[i].end;
+        t.user += p.user;
+        t.sys += p.sys;
+        if (p.maxrss > t.maxrss) t.maxrss = p.maxrss;
+        t.majflt += p.majflt;
+        t.minflt += p.minflt;
+        t.nvcsw += p.nvcsw;
+        t.nivcsw += p.nivcsw;
+        t.io.rchar += p.io.rchar;
+        t.io.wchar += p.io.wchar;
+        t.io.read_bytes += p.io.read_bytes;
+        t.io.write_bytes += p.io.write_bytes;
+    }
+    t.real = ts_diff(end, start);
+    return t;
+}
+
+/** Formats a byte count with a binary suffix, e.g. 12.5K */
+static char const *
+human_bytes(uint64_t n, char *buf, size_t size) {
+    static char const units[] = "BKMGTP";
+    double val = (double) n;
+    size_t u = 0;
+    while (val >= 1024 && u + 1 < sizeof units - 1) {
+        val /= 1024;
+        ++u;
+    }
+    if (u == 0) snprintf(buf, size, "%" PRIu64 "B", n);
+    else snprintf(buf, size, "%.1f%c", val, units[u]);
+    return buf;
+}
+
+static void
+print_row(char const *label, char const *status, struct totals const *t) {
+    char rd[16];
+    char wr[16];
+    fprintf(stderr,
+            "%-20s %6s %9.3f %9.3f %9.3f %8ld %6ld %7ld %6ld %6ld %8s %8s\n",
+            label,
+            status,
+            t->real,
+            t->user,
+            t->sys,
+            t->maxrss,
+            t->majflt,
+            t->minflt,
+            t->nvcsw,
+            t->nivcsw,
+            human_bytes(t->io.rchar, rd, sizeof rd),
+            human_bytes(t->io.wchar, wr, sizeof wr));
+}
+
+static void
+print_table(struct process const *procs, size_t n, struct totals const *total, int status) {
+    fprintf(stderr,
+            "%-20s %6s %9s %9s %9s %8s %6s %7s %6s %6s %8s %8s\n",
+            "COMMAND", "STATUS", "REAL", "USER", "SYS", "MAXRSS", "MAJFLT", "MINFLT",
+            "VCSW", "IVCSW", "READ", "WRITE");
+    char label[40];
+    char st[16];
+    for (size_t i = 0; i < n; ++i) {
+        struct totals const t = process_totals(&procs[i]);
+        snprintf(label, sizeof label, "%s[%jd]", procs[i].io.comm, (intmax_t) procs[i].pid);
+        snprintf(st, sizeof st, "%d", wait_exit_status(procs[i].status));
+        print_row(label, st, &t);
+    }
+    if (n > 1) {
+        snprintf(st, sizeof st, "%d", status);
+        print_row("total", st, total);
+    }
+}
+
+/** Prints the figures shared by a job and its processes as JSON members */
+static void
+print_json_figures(struct totals const *t) {
+    fprintf(stderr,
+            "\"real\":%.6f,\"user\":%.6f,\"sys\":%.6f,\"maxrss_kb\":%ld,"
+            "\"major_faults\":%ld,\"minor_faults\":%ld,"
+            "\"voluntary_switches\":%ld,\"involuntary_switches\":%ld,"
+            "\"read_bytes\":%" PRIu64 ",\"write_bytes\":%" PRIu64 ","
+            "\"storage_read_bytes\":%" PRIu64 ",\"storage_write_bytes\":%" PRIu64,
+            t->real, t->user, t->sys, t->maxrss, t->majflt, t->minflt, t->nvcsw, t->nivcsw,
+            t->io.rchar, t->io.wchar, t->io.read_bytes, t->io.write_bytes);
+}
+
+static void
+print_json(struct process const *procs, size_t n, struct totals const *total, int status) {
+    fprintf(stderr, "{\"status\":%d,", status);
+    print_json_figures(total);
+    fputs(",\"stages\":[", stderr);
+    for (size_t i = 0; i < n; ++i) {
+        struct totals const t = process_totals(&procs[i]);
+        fprintf(stderr, "%s{\"pid\":%jd,\"command\":\"", i ? "," : "", (intmax_t) procs[i].pid);
+        for (char const *c = procs[i].io.comm; *c; ++c) {
+            if (*c == '"' || *c == '\\') fprintf(stderr, "\\%c", *c);
+            else if ((unsigned char) *c < 0x20) fprintf(stderr, "\\u%04x", *c);
+            else fputc(*c, stderr);
+        }
+        fprintf(stderr, "\",\"status\":%d,", wait_exit_status(procs[i].status));
+        print_json_figures(&t);
+        fputc('}', stderr);
+    }
+    fputs("]}\n", stderr);
+}
+
+/** Prints times as bash does for TIMEFORMAT: %[p][l]R, U or S, %P and %% */
+static void
+print_format(char const *fmt, struct totals const *t) {
+    for (char const *c = fmt; *c; ++c) {
+        if (*c != '%') {
+            fputc(*c, stderr);
+            continue;
+        }
+        ++c;
+        int precision = 3;
+        int minutes = 0;
+        if (*c >= '0' && *c <= '9') precision = *c++ - '0';
+        if (precision > 3) precision = 3;
+        if (*c == 'l') {
+            minutes = 1;
+            ++c;
+        }
+
+        double secs;
+        if (*c == 'R') secs = t->real;
+        else if (*c == 'U') secs = t->user;
+        else if (*c == 'S') secs = t->sys;
+        else if (*c == 'P') {
+            fprintf(stderr, "%.2f", t->real > 0 ? (t->user + t->sys) * 100 / t->real : 0.0);
+            continue;
+        } else if (*c == '%') {
+            fputc('%', stderr);
+            continue;
+        } else {
+            if (!*c) break;
+            fputc('%', stderr);
+            fputc(*c, stderr);
+            continue;
+        }
+        if (minutes) {
+            long const m = (long) (secs / 60);
+            fprintf(stderr, "%ldm%.*fs", m, precision, secs - 60.0 * (double) m);
+        } else {
+            fprintf(stderr, "%.*f", precision, secs);
+        }
+    }
+    fputc('\n', stderr);
+}
+
+/** Reports on a finished job's processes
+ *
+ * @param status the job's exit status
+ */
+static void
+report(struct process const *procs, size_t n, int status, enum timing_format format) {
+    if (!n) return;
+    struct totals const total = job_totals(procs, n);
+    fflush(stdout);
+    if (format == TIMING_POSIX) {
+        fprintf(stderr, "real %.2f\nuser %.2f\nsys %.2f\n", total.real, total.user, total.sys);
+        return;
+    }
+
+    char const *fmt = vars_get("TIMEFORMAT");
+    if (!fmt) print_table(procs, n, &total, status);
+    else if (strcmp(fmt, "json") == 0) print_json(procs, n, &total, status);
+    else if (*fmt) print_format(fmt, &total);
+}
+
+void
+timing_report(jid_t jid) {
+    struct job const *job = jobs_get(jid);
+    if (!job || !job->measured || jobs_get_state(jid) != JOB_DONE) return;
+    report(job->procs, job->proc_count, wait_job_exit_status(jid), job->measured);
+}
+
+void
+timing_self_begin(struct timing_self *t) {
+    struct process *p = &t->before;
+    *p = (struct process) {.pid = getpid()};
+    timing_read_io(p->pid, &p->io);
+    getrusage(RUSAGE_SELF, &p->usage);
+    clock_gettime(CLOCK_MONOTONIC, &p->start);
+}
+
+static struct timeval
+tv_sub(struct timeval a, struct timeval b) {
+    struct timeval r;
+    timersub(&a, &b, &r);
+    return r;
+}
+
+void
+timing_self_end(struct timing_self const *t,
+                enum timing_format format,
+                char const *name,
+                int status) {
+    struct process const *b = &t->before;
+    struct process p = {.pid = b->pid, .status = W_EXITCODE(status, 0), .start = b->start};
+    clock_gettime(CLOCK_MONOTONIC, &p.end);
+    getrusage(RUSAGE_SELF, &p.usage);
+    timing_read_io(p.pid, &p.io);
+
+    /* Everything but the peak is counted from the start */
+    p.usage.ru_utime = tv_sub(p.usage.ru_utime, b->usage.ru_utime);
+    p.usage.ru_stime = tv_sub(p.usage.ru_stime, b->usage.ru_stime);
+    p.usage.ru_majflt -= b->usage.ru_majflt;
+    p.usage.ru_minflt -= b->usage.ru_minflt;
+    p.usage.ru_nvcsw -= b->usage.ru_nvcsw;
+    p.usage.ru_nivcsw -= b->usage.ru_nivcsw;
+    p.io.rchar -= b->io.rchar;
+    p.io.wchar -= b->io.wchar;
+    p.io.read_bytes -= b->io.read_bytes;
+    p.io.write_bytes -= b->io.write_bytes;
+    snprintf(p.io.comm, sizeof p.io.comm, "%s", name);
+
+    report(&p, 1, status, format);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include "jobs.h"
+
+/* How a measured job is reported on; see jobs_set_measured() */
+enum timing_format {
+    TIMING_DEFAULT = 1, /* As $TIMEFORMAT says */
+    TIMING_POSIX,       /* time -p: real, user and sys in seconds, as POSIX says */
+};
+
+/* Where an in-shell builtin timed with the time keyword started from */
+struct timing_self {
+    struct process before; /* The shell's own usage and I/O counters */
+};
+
+/** Reads a process's I/O counters and command name, from /proc/<pid>/io
+ *  and /proc/<pid>/comm
+ *
+ * @returns 0 on success, -1 on failure (e.g. no I/O accounting)
+ *
+ * A child's are gone once it's reaped, so this is done while it's a zombie,
+ * between a waitid() with WNOWAIT and the wait4() that reaps it.
+ */
+extern int timing_read_io(pid_t pid, struct proc_io *io);
+
+/** Reports on a finished job marked with jobs_set_measured(), if it is
+ *
+ * Writes to stderr, in a format set by $TIMEFORMAT: if unset, a table with a
+ * line per process and one for the totals; json for the same as one line of
+ * JSON; empty for nothing; anything else is printed with %R, %U and %S
+ * replaced by the job's real, user and system time in seconds (%3lR for
+ * 3 decimals in minutes and seconds, as in bash) and %P by the CPU
+ * percentage.
+ */
+extern void timing_report(jid_t jid);
+
+/** Starts timing a builtin run in the shell itself */
+extern void timing_self_begin(struct timing_self *t);
+
+/** Reports on a builtin run in the shell itself, as for a job of one process
+ *
+ * @param name   the builtin's name
+ * @param status its exit status
+ */
+extern void timing_self_end(struct timing_self const *t,
+                            enum timing_format format,
+                            char const *name,
+                            int status);
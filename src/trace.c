@@ -0,0 +1,73 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+struct trace_header *trace_buffer = 0;
+
+/* getpid() is a system call; forked children refresh this instead */
+static int32_t self = 0;
+
+static void
+trace_forked(void) {
+    self = (int32_t) getpid();
+}
+
+int
+trace_open(char const *path) {
+    size_t const size = sizeof(struct trace_header) + sizeof(struct trace_record) * TRACE_CAPACITY;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0) return -1;
+    if (ftruncate(fd, (off_t) size) < 0) goto err;
+    void *p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) goto err;
+    close(fd);
+
+    /* The file is zero-filled, so every record starts out empty */
+    struct trace_header *h = p;
+    memcpy(h->magic, TRACE_MAGIC, sizeof h->magic);
+    h->record_size = sizeof(struct trace_record);
+    h->capacity = TRACE_CAPACITY;
+    trace_buffer = h;
+    self = (int32_t) getpid();
+    pthread_atfork(0, 0, trace_forked);
+    return 0;
+
+    err:
+    close(fd);
+    return -1;
+}
+
+uint64_t
+trace_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+void
+trace_record(enum trace_type type, int32_t a, int32_t b, uint64_t dur, char const *name) {
+    uint64_t const ts = trace_now();
+
+    uint64_t const i = __atomic_fetch_add(&trace_buffer->head, 1, __ATOMIC_RELAXED);
+    struct trace_record *r = (struct trace_record *) (trace_buffer + 1) + (i & (TRACE_CAPACITY - 1));
+
+    /* Unpublish the slot while it's rewritten */
+    __atomic_store_n(&r->type, TRACE_NONE, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    r->ts = ts;
+    r->dur = dur;
+    r->pid = self;
+    r->a = a;
+    r->b = b;
+    size_t const len = name ? strnlen(name, sizeof r->name) : 0;
+    if (len) memcpy(r->name, name, len);
+    if (len < sizeof r->name) r->name[len] = '\0';
+    __atomic_store_n(&r->type, (uint16_t) type, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Binary event trace, enabled with MS_TRACE=/path at startup
+ *
+ * The file is a header followed by a fixed ring of fixed-size records,
+ * mapped shared into the shell, so children forked from it keep writing to
+ * the same ring until they exec. Writers claim slots with an atomic counter
+ * and publish a record by storing its type last; a slot whose type is zero
+ * is empty or half-written. Once the ring fills, the oldest records are
+ * overwritten.
+ *
+ * Decode with tools/tracedecode (make tracedecode), which writes Chrome
+ * trace JSON, for chrome://tracing or Perfetto.
+ */
+
+#define TRACE_MAGIC "MSTRACE1"
+#define TRACE_CAPACITY (1u << 16) /* Records in the ring; a power of two */
+
+enum trace_type {
+    TRACE_NONE,
+    TRACE_LINE_READ,  /* a: bytes read; dur: time waiting for them */
+    TRACE_PARSE_DONE, /* a: commands parsed, or an error; dur: parse time */
+    TRACE_EXPAND,     /* name: command; dur: time expanding its words */
+    TRACE_FORK,       /* a: child pid; b: its pgid; name: command */
+    TRACE_EXEC,       /* a: pid; b: its pgid; name: path; dur: time in posix_spawn() */
+    TRACE_EXIT,       /* a: pid; b: wait status */
+    TRACE_STOP,       /* a: pid; b: wait status */
+    TRACE_CONT,       /* a: pid */
+    TRACE_JOB_ADD,    /* a: job id; b: pgid */
+    TRACE_JOB_REMOVE, /* a: job id; b: pgid */
+    TRACE_TYPE_COUNT,
+};
+
+struct trace_record {
+    uint64_t ts;  /* CLOCK_MONOTONIC, in nanoseconds */
+    uint64_t dur; /* Nanoseconds, for events that took time; ends at ts */
+    int32_t pid;  /* Process that recorded it */
+    int32_t a;
+    int32_t b;
+    uint16_t type; /* enum trace_type; stored last */
+    uint16_t reserved;
+    char name[16]; /* Truncated, not always terminated */
+};
+
+struct trace_header {
+    char magic[8];
+    uint32_t record_size;
+    uint32_t capacity;
+    uint64_t head; /* Records ever claimed; the next goes in head % capacity */
+    uint64_t reserved[5];
+};
+
+/* The mapped ring, or null pointer if tracing is off */
+extern struct trace_header *trace_buffer;
+
+/** Starts tracing into a file, replacing its contents
+ *
+ * @returns 0 on success, -1 on failure
+ */
+extern int trace_open(char const *path);
+
+/** Records an event; see trace_event() */
+extern void trace_record(enum trace_type type,
+                         int32_t a,
+                         int32_t b,
+                         uint64_t dur,
+                         char const *name);
+
+/** Gets CLOCK_MONOTONIC in nanoseconds, as events are stamped with */
+extern uint64_t trace_now(void);
+
+/** Starts timing an event, if tracing is on; cheaper than trace_now() when
+ *  it's off, where durations come out as zero */
+static inline uint64_t
+trace_clock(void) {
+    return __builtin_expect(trace_buffer != 0, 0) ? trace_now() : 0;
+}
+
+/** Records an event, if tracing is on
+ *
+ * @param name  null pointer if none
+ */
+static inline void
+trace_event(enum trace_type type, int32_t a, int32_t b, uint64_t dur, char const *name) {
+    if (__builtin_expect(trace_buffer != 0, 0)) trace_record(type, a, b, dur, name);
+}
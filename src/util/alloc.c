@@ -0,0 +1,264 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "alloc.h"
+
+static char const *const tag_names[ALLOC_TAG_COUNT] = {
+        [ALLOC_PARSER] = "parser",
+        [ALLOC_EXPAND] = "expand",
+        [ALLOC_VARS] = "vars",
+        [ALLOC_JOBS] = "jobs",
+        [ALLOC_RUNNER] = "runner",
+        [ALLOC_ASPRINTF] = "asprintf",
+        [ALLOC_GLOB] = "glob",
+};
+
+#ifdef ALLOC_ACCOUNTING
+struct tag_totals {
+    uint64_t calls;  /* Allocations made */
+    uint64_t bytes;  /* Live */
+    uint64_t peak;   /* Most bytes live at once */
+    uint64_t blocks; /* Live */
+};
+
+static struct tag_totals totals[ALLOC_TAG_COUNT];
+
+/* Tagged blocks, in an open-addressed table with linear probing. The table
+ * is mapped rather than allocated, since free() calls in here. */
+struct block {
+    void *ptr; /* null pointer if the slot is empty */
+    size_t size;
+    enum alloc_tag tag;
+};
+
+static struct block *table = 0;
+static size_t table_size = 0; /* A power of two */
+static size_t table_used = 0;
+
+/* Pipe feeder threads allocate and free too */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+lock_table(void) {
+    pthread_mutex_lock(&lock);
+}
+
+static void
+unlock_table(void) {
+    pthread_mutex_unlock(&lock);
+}
+
+/* A child forked while a thread held the lock would never see it released */
+__attribute__((constructor)) static void
+alloc_init(void) {
+    pthread_atfork(lock_table, unlock_table, unlock_table);
+}
+
+static size_t
+slot_of(void const *ptr) {
+    return (size_t) (((uintptr_t) ptr >> 4) * UINT64_C(0x9E3779B97F4A7C15) >> 17) & (table_size - 1);
+}
+
+static struct block *
+find_block(void const *ptr) {
+    if (!table) return 0;
+    for (size_t i = slot_of(ptr);; i = (i + 1) & (table_size - 1)) {
+        if (table[i].ptr == ptr) return &table[i];
+        if (!table[i].ptr) return 0;
+    }
+}
+
+/** Doubles the table, or creates it
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static int
+grow_table(void) {
+    size_t const old_size = table_size;
+    struct block *const old = table;
+    size_t const size = old_size ? old_size * 2 : 4096;
+    void *p = mmap(0, sizeof *table * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return -1;
+    table = p;
+    table_size = size;
+    for (size_t i = 0; i < old_size; ++i) {
+        if (!old[i].ptr) continue;
+        size_t j = slot_of(old[i].ptr);
+        while (table[j].ptr) j = (j + 1) & (table_size - 1);
+        table[j] = old[i];
+    }
+    if (old) munmap(old, sizeof *old * old_size);
+    return 0;
+}
+
+static void
+remove_block(struct block *b) {
+    struct tag_totals *t = &totals[b->tag];
+    t->bytes -= b->size;
+    --t->blocks;
+    --table_used;
+
+    /* Shift later blocks of the same probe run back over the hole */
+    size_t hole = (size_t) (b - table);
+    for (size_t i = (hole + 1) & (table_size - 1); table[i].ptr; i = (i + 1) & (table_size - 1)) {
+        size_t const home = slot_of(table[i].ptr);
+        if (((i - home) & (table_size - 1)) >= ((i - hole) & (table_size - 1))) {
+            table[hole] = table[i];
+            hole = i;
+        }
+    }
+    table[hole].ptr = 0;
+}
+
+/** Tags a block, replacing any tag it had */
+static void
+note(enum alloc_tag tag, void *ptr, size_t size) {
+    int const saved_errno = errno;
+    lock_table();
+    struct block *b = find_block(ptr);
+    if (b) {
+        remove_block(b);
+    } else if (2 * (table_used + 1) > table_size && grow_table() < 0) {
+        goto out; /* Goes unaccounted */
+    }
+    size_t i = slot_of(ptr);
+    while (table[i].ptr) i = (i + 1) & (table_size - 1);
+    table[i] = (struct block) {.ptr = ptr, .size = size, .tag = tag};
+    ++table_used;
+
+    struct tag_totals *t = &totals[tag];
+    t->bytes += size;
+    ++t->blocks;
+    if (t->bytes > t->peak) t->peak = t->bytes;
+
+    out:
+    unlock_table();
+    errno = saved_errno;
+}
+
+void
+alloc_freed(void *ptr) {
+    if (!table) return;
+    lock_table();
+    struct block *b = find_block(ptr);
+    if (b) remove_block(b);
+    unlock_table();
+}
+
+void
+alloc_moved(void *old, void *new, size_t size) {
+    if (!table) return;
+    lock_table();
+    struct block *b = find_block(old);
+    enum alloc_tag tag = ALLOC_TAG_COUNT;
+    if (b) {
+        tag = b->tag;
+        remove_block(b);
+    }
+    unlock_table();
+    if (new && tag != ALLOC_TAG_COUNT) note(tag, new, size);
+}
+
+static void *
+counted(enum alloc_tag tag, void *ptr, size_t size) {
+    __atomic_fetch_add(&totals[tag].calls, 1, __ATOMIC_RELAXED);
+    if (ptr) note(tag, ptr, size);
+    return ptr;
+}
+
+void *
+alloc_malloc(enum alloc_tag tag, size_t size) {
+    return counted(tag, malloc(size), size);
+}
+
+void *
+alloc_calloc(enum alloc_tag tag, size_t n, size_t size) {
+    return counted(tag, calloc(n, size), n * size);
+}
+
+void *
+alloc_realloc(enum alloc_tag tag, void *ptr, size_t size) {
+    return counted(tag, realloc(ptr, size), size);
+}
+
+char *
+alloc_strdup(enum alloc_tag tag, char const *s) {
+    size_t const size = strlen(s) + 1;
+    return counted(tag, strdup(s), size);
+}
+
+char *
+alloc_strndup(enum alloc_tag tag, char const *s, size_t n) {
+    char *p = strndup(s, n);
+    return counted(tag, p, p ? strlen(p) + 1 : 0);
+}
+
+int
+alloc_print(int fd, int json) {
+    /* Copied first, so printing's own allocations don't show */
+    lock_table();
+    struct tag_totals t[ALLOC_TAG_COUNT];
+    memcpy(t, totals, sizeof t);
+    unlock_table();
+
+    FILE *f = fdopen(dup(fd), "w");
+    if (!f) return -1;
+    if (json) {
+        fputc('{', f);
+        for (size_t i = 0; i < ALLOC_TAG_COUNT; ++i) {
+            fprintf(f,
+                    "%s\"%s\":{\"calls\":%llu,\"bytes\":%llu,\"peak\":%llu,\"blocks\":%llu}",
+                    i ? "," : "",
+                    tag_names[i],
+                    (unsigned long long) t[i].calls,
+                    (unsigned long long) t[i].bytes,
+                    (unsigned long long) t[i].peak,
+                    (unsigned long long) t[i].blocks);
+        }
+        fputs("}\n", f);
+    } else {
+        fprintf(f, "%-10s %10s %12s %12s %10s\n", "", "calls", "live bytes", "peak bytes", "blocks");
+        for (size_t i = 0; i < ALLOC_TAG_COUNT; ++i) {
+            fprintf(f,
+                    "%-10s %10llu %12llu %12llu %10llu\n",
+                    tag_names[i],
+                    (unsigned long long) t[i].calls,
+                    (unsigned long long) t[i].bytes,
+                    (unsigned long long) t[i].peak,
+                    (unsigned long long) t[i].blocks);
+        }
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+void
+alloc_report_leaks(void) {
+    for (size_t i = 0; i < ALLOC_TAG_COUNT; ++i) {
+        if (!totals[i].blocks) continue;
+        fprintf(stderr,
+                "minishell: %s: %llu bytes still allocated in %llu blocks\n",
+                tag_names[i],
+                (unsigned long long) totals[i].bytes,
+                (unsigned long long) totals[i].blocks);
+    }
+}
+#else
+int
+alloc_print(int fd, int json) {
+    (void) fd;
+    (void) json;
+    (void) tag_names;
+    errno = ENOTSUP;
+    return -1;
+}
+
+void
+alloc_report_leaks(void) {
+}
+#endif
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Allocation accounting by subsystem
+ *
+ * Allocations made through the alloc_*() wrappers are tagged with the
+ * subsystem they belong to. In debug builds (on glibc, where the shell sees
+ * every free() through stats.c), each tagged block is remembered until it's
+ * freed, wherever that happens, giving each subsystem's live and peak bytes;
+ * the memstats builtin prints them, and blocks still live when the shell
+ * exits are reported as leaks. In release builds the wrappers are the plain
+ * allocator calls.
+ */
+
+#if !defined(NDEBUG) && defined(__GLIBC__)
+#define ALLOC_ACCOUNTING 1
+#endif
+
+enum alloc_tag {
+    ALLOC_PARSER,   /* Command lists */
+    ALLOC_EXPAND,   /* Expanded words */
+    ALLOC_VARS,     /* Shell variables */
+    ALLOC_JOBS,     /* The job table */
+    ALLOC_RUNNER,   /* Builtin redirection lists, pipe feeders, queued jobs */
+    ALLOC_ASPRINTF, /* Formatted strings */
+    ALLOC_GLOB,     /* Pathname expansion and its directory cache */
+    ALLOC_TAG_COUNT,
+};
+
+#ifdef ALLOC_ACCOUNTING
+extern void *alloc_malloc(enum alloc_tag tag, size_t size);
+extern void *alloc_calloc(enum alloc_tag tag, size_t n, size_t size);
+extern void *alloc_realloc(enum alloc_tag tag, void *ptr, size_t size);
+extern char *alloc_strdup(enum alloc_tag tag, char const *s);
+extern char *alloc_strndup(enum alloc_tag tag, char const *s, size_t n);
+
+/** Forgets a block being freed; called for every free() */
+extern void alloc_freed(void *ptr);
+
+/** Moves a block's tag to where realloc() put it, or forgets it if realloc()
+ *  freed it (new is null pointer) */
+extern void alloc_moved(void *old, void *new, size_t size);
+#else
+static inline void *
+alloc_malloc(enum alloc_tag tag, size_t size) {
+    (void) tag;
+    return malloc(size);
+}
+
+static inline void *
+alloc_calloc(enum alloc_tag tag, size_t n, size_t size) {
+    (void) tag;
+    return calloc(n, size);
+}
+
+static inline void *
+alloc_realloc(enum alloc_tag tag, void *ptr, size_t size) {
+    (void) tag;
+    return realloc(ptr, size);
+}
+
+static inline char *
+alloc_strdup(enum alloc_tag tag, char const *s) {
+    (void) tag;
+    return strdup(s);
+}
+
+static inline char *
+alloc_strndup(enum alloc_tag tag, char const *s, size_t n) {
+    (void) tag;
+    return strndup(s, n);
+}
+#endif
+
+/** Prints each subsystem's allocation calls, live and peak bytes, and live
+ *  blocks, as text or as one line of JSON
+ *
+ * @returns 0 on success, -1 on failure (e.g. accounting is not built in)
+ */
+extern int alloc_print(int fd, int json);
+
+/** Reports blocks still allocated, per subsystem, to stderr
+ *
+ * Done when the shell exits, after its own cleanup.
+ */
+extern void alloc_report_leaks(void);
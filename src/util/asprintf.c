@@ -4,6 +4,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 
+#include "alloc.h"
 #include "asprintf.h"
 
 int asprintf(char **restrict strp, char const *restrict fmt, ...) {
@@ -20,7 +21,7 @@ int vasprintf(char **restrict strp, char const *restrict fmt, va_list ap) {
     int sz = vsnprintf(0, 0, fmt, ap_copy);
     va_end(ap_copy);
 
-    void *tmp = malloc(sz + 1);
+    void *tmp = alloc_malloc(ALLOC_ASPRINTF, sz + 1);
     if (!tmp) return -1;
     *strp = tmp;
 
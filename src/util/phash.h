@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+/** Seeded FNV-1a hash of a string
+ *
+ * Shared by the builtin table generator and the lookup, which must agree on
+ * every bit of it.
+ */
+static inline uint32_t
+phash(char const *s, uint32_t seed) {
+    uint32_t h = 2166136261u ^ seed;
+    for (; *s; ++s) {
+        h ^= (unsigned char) *s;
+        h *= 16777619u;
+    }
+    /* Low bits of a product only depend on low bits of its operands; fold
+     * the high bits in so that the seed matters to a masked slot */
+    return h ^ (h >> 16);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+/* USDT probes, in the format of systemtap's <sys/sdt.h>, without needing it
+ *
+ * A probe site is a single nop. Next to it, an ELF note in .note.stapsdt
+ * records where the nop is, the probe's provider ("minishell") and name, and
+ * where its arguments live at that point (e.g. -8@%rax), for tracers like
+ * bpftrace, perf or systemtap to find:
+ *
+ *   bpftrace -e 'usdt:./release/minishell:minishell:wait_fg_done { ... }'
+ *
+ * Each probe also has a semaphore, which tracers raise while attached, so
+ * arguments that cost something to work out (timings, mostly) are only
+ * worked out then; see PROBE_ENABLED(). The probes themselves are listed in
+ * probes.def.
+ *
+ * Arguments are all passed as signed 64-bit integers; pointers (strings)
+ * included, which tracers read with str().
+ */
+
+/* Semaphore of a probe */
+#define PROBE_SEMAPHORE(name) minishell_##name##_semaphore
+
+/* Checks if a tracer is attached to a probe */
+#define PROBE_ENABLED(name) __builtin_expect(PROBE_SEMAPHORE(name) != 0, 0)
+
+#define PROBE_STR_(x) #x
+#define PROBE_STR(x) PROBE_STR_(x)
+
+/* The note for one probe site; args is its argument description */
+#define PROBE_ASM_(name, args)                                            \
+    "990: nop\n"                                                          \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n"                         \
+    ".balign 4\n"                                                         \
+    ".4byte 992f-991f, 994f-993f, 3\n"                                    \
+    "991: .asciz \"stapsdt\"\n"                                           \
+    "992: .balign 4\n"                                                    \
+    "993: .8byte 990b\n"                                                  \
+    ".8byte _.stapsdt.base\n"                                             \
+    ".8byte " PROBE_STR(PROBE_SEMAPHORE(name)) "\n"                       \
+    ".asciz \"minishell\"\n"                                              \
+    ".asciz \"" #name "\"\n"                                              \
+    ".asciz \"" args "\"\n"                                               \
+    "994: .balign 4\n"                                                    \
+    ".popsection\n"                                                       \
+    ".ifndef _.stapsdt.base\n"                                            \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+    ".weak _.stapsdt.base\n"                                              \
+    ".hidden _.stapsdt.base\n"                                            \
+    "_.stapsdt.base: .space 1\n"                                          \
+    ".size _.stapsdt.base, 1\n"                                           \
+    ".popsection\n"                                                       \
+    ".endif\n"
+
+/* One argument: an immediate, register or memory operand */
+#define PROBE_ARG_(n, x) [a##n] "nor"((int64_t) (x))
+
+#define PROBE0(name) __asm__ __volatile__(PROBE_ASM_(name, ""))
+#define PROBE1(name, x1) __asm__ __volatile__(PROBE_ASM_(name, "-8@%[a1]") : : PROBE_ARG_(1, x1))
+#define PROBE2(name, x1, x2)                                                    \
+    __asm__ __volatile__(PROBE_ASM_(name, "-8@%[a1] -8@%[a2]")                  \
+                         :                                                      \
+                         : PROBE_ARG_(1, x1), PROBE_ARG_(2, x2))
+#define PROBE3(name, x1, x2, x3)                                                \
+    __asm__ __volatile__(PROBE_ASM_(name, "-8@%[a1] -8@%[a2] -8@%[a3]")         \
+                         :                                                      \
+                         : PROBE_ARG_(1, x1), PROBE_ARG_(2, x2), PROBE_ARG_(3, x3))
+#define PROBE4(name, x1, x2, x3, x4)                                            \
+    __asm__ __volatile__(PROBE_ASM_(name, "-8@%[a1] -8@%[a2] -8@%[a3] -8@%[a4]") \
+                         :                                                      \
+                         : PROBE_ARG_(1, x1), PROBE_ARG_(2, x2), PROBE_ARG_(3, x3), \
+                           PROBE_ARG_(4, x4))
+
+/** Gets CLOCK_MONOTONIC in nanoseconds, for probe timings */
+static inline int64_t
+probe_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -7,6 +7,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "pathcache.h"
+#include "util/alloc.h"
 #include "vars.h"
 
 struct var {
@@ -65,7 +67,7 @@ static struct var *
 new_var(char const *name) {
     assert(is_valid_varname(name));
     assert(!find_var(name));
-    struct var *v = malloc(sizeof *v + strlen(name) + 1);
+    struct var *v = alloc_malloc(ALLOC_VARS, sizeof *v + strlen(name) + 1);
     if (!v) return 0;
     strcpy(v->name, name);
 
@@ -116,12 +118,15 @@ vars_set(char const *name, char const *value) {
     struct var *v = ensure_var(name);
     if (!v) return -1;
 
+    if (strcmp(name, "PATH") == 0) pathcache_clear();
+
     if (v->export) {
         return setenv(name, value, 1);
     }
 
-    char *dupval = strdup(value);
+    char *dupval = alloc_strdup(ALLOC_VARS, value);
     if (!dupval) return -1;
+    free(v->value);
     v->value = dupval;
     return 0;
 }
@@ -149,6 +154,7 @@ vars_unset(char const *name) {
         return -1;
     }
     remove_var(name);
+    if (strcmp(name, "PATH") == 0) pathcache_clear();
     return unsetenv(name);
 }
 
@@ -1,81 +1,203 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 
 #include <assert.h>
 #include <errno.h>
+#include <poll.h>
 #include <stdint.h>
+#include <signal.h>
 #include <stdio.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "jobs.h"
 #include "params.h"
+#include "pipes.h"
+#include "probes.h"
+#include "runner.h"
+#include "stats.h"
+#include "timers.h"
+#include "timing.h"
+#include "trace.h"
 #include "wait.h"
 
+/* The shell's own process group, to hand the terminal back to */
+static pid_t shell_pgid = 0;
+
+/* Readable whenever a SIGCHLD is pending */
+static int sigchld_fd = -1;
+
+/* Job being waited on in the foreground, or -1 */
+static jid_t fg_jid = -1;
+
 int
-wait_on_fg_gid(pid_t pgid) {
-    if (pgid < 0) return -1;
-    /* Make sure the foreground group is running */
-    if (kill(pgid, SIGCONT) == -1) return -1;
+wait_init(void) {
+    sigset_t sigchld;
+    sigemptyset(&sigchld);
+    sigaddset(&sigchld, SIGCHLD);
+    sigchld_fd = signalfd(-1, &sigchld, SFD_NONBLOCK | SFD_CLOEXEC);
+    return sigchld_fd < 0 ? -1 : 0;
+}
 
-    if (isatty(STDIN_FILENO)) {
-        if (tcsetpgrp(STDIN_FILENO, pgid) == -1) return -1;
-    } else {
-        switch (errno) {
-            case ENOTTY:
+int
+wait_reap(void) {
+    /* Drain pending SIGCHLDs first; any child exiting after this point
+     * raises a new one */
+    struct signalfd_siginfo info[16];
+    while (read(sigchld_fd, info, sizeof info) > 0) continue;
+    if (errno != EAGAIN) return -1;
+    errno = 0;
+
+    for (;;) {
+        /* A measured job's processes take their I/O counters with them, so
+         * while there are any, look at each child before reaping it */
+        pid_t pid = -1;
+        if (jobs_count_measured()) {
+            siginfo_t info = {0};
+            int const flags = WEXITED | WSTOPPED | WCONTINUED | WNOHANG | WNOWAIT;
+            if (waitid(P_ALL, 0, &info, flags) == 0) {
+                if (info.si_pid == 0) break;
+                pid = info.si_pid;
+                jid_t jid = -1;
+                int const exited = info.si_code == CLD_EXITED || info.si_code == CLD_KILLED ||
+                                   info.si_code == CLD_DUMPED;
+                if (exited && jobs_get_process(pid, &jid) && jobs_measured(jid)) {
+                    struct proc_io io;
+                    timing_read_io(pid, &io);
+                    jobs_set_io(pid, &io);
+                }
+            }
+        }
+
+        int status;
+        struct rusage usage;
+        pid = wait4(pid, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage);
+        if (pid == 0) break;
+        if (pid < 0) {
+            if (errno == ECHILD) {
                 errno = 0;
                 break;
-            default:
-                return -1;
+            }
+            if (errno == EINTR) continue;
+            return -1;
         }
+        jobs_update(pid, status, &usage); /* Children outside any job are just reaped */
+        if (WIFSTOPPED(status)) trace_event(TRACE_STOP, pid, status, 0, 0);
+        else if (WIFCONTINUED(status)) trace_event(TRACE_CONT, pid, 0, 0, 0);
+        else trace_event(TRACE_EXIT, pid, status, 0, 0);
+    }
+
+    /* Jobs that finished may have made room for queued ones; the foreground
+     * job isn't a background job, so doesn't take up room */
+    int const fg_state = jobs_get_state(fg_jid);
+    run_queued(fg_state == JOB_RUNNING || fg_state == JOB_STOPPED);
+    return 0;
+}
+
+/** Blocks until a child changes state, or the timeout expires
+ *
+ * @param timeout_ms as for poll()
+ * @returns 1 if a child changed state, 0 on timeout, -1 on failure
+ *
+ * Job timeouts falling due meanwhile are handled, and count as a change.
+ */
+static int
+wait_sigchld(int timeout_ms) {
+    struct pollfd pfds[2] = {
+            {.fd = sigchld_fd, .events = POLLIN},
+            {.fd = timers_fd(), .events = POLLIN},
+    };
+    int res = poll(pfds, 2, timeout_ms);
+    if (res < 0 && errno == EINTR) {
+        errno = 0;
+        return 0;
     }
+    if (res > 0 && pfds[1].revents && timers_expire() < 0) return -1;
+    return res > 0 ? 1 : res;
+}
+
+int
+wait_exit_status(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return 0;
+}
+
+int
+wait_job_exit_status(jid_t jid) {
+    int status = 0;
+    jobs_get_status(jid, &status);
+    if (jobs_timed_out(jid) && !(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL)) return 124;
+    return wait_exit_status(status);
+}
+
+int
+wait_for_child(void) {
+    struct pollfd pfds[2] = {
+            {.fd = sigchld_fd, .events = POLLIN},
+            {.fd = timers_fd(), .events = POLLIN},
+    };
+    if (poll(pfds, 2, -1) < 0) return -1;
+    if (pfds[1].revents && timers_expire() < 0) return -1;
+    return 0;
+}
+
+int
+wait_on_fg_gid(pid_t pgid) {
+    if (pgid < 0) return -1;
+    jid_t const jid = jobs_get_jid(pgid);
+    if (jid < 0) return -1;
+    struct timespec const start = stats_begin();
+    PROBE2(wait_fg_start, pgid, jid);
+
+    /* Stopped jobs are continued by fg; new ones are already running. Without
+     * a terminal there's nothing to hand over. */
+    fg_jid = jid;
+    if (params.terminal) {
+        if (!shell_pgid) shell_pgid = getpgid(0);
+        if (shell_pgid == -1) return -1;
+        if (tcsetpgrp(STDIN_FILENO, pgid) == -1) return -1;
+    }
+
+    /* Adaptive pipe sizing checks the pipeline's pipes whenever it has been
+     * quiet for a while */
+    int const adaptive = pipe_adaptive();
+    int tick_ms = 1;
 
     int retval = 0;
-    int last_status = 0;
     for (;;) {
-        /* Wait on all processes in the process group 'pgid' */
-        int status;
-        pid_t res = waitpid(-pgid, &status, WSTOPPED);
-        if (res < 0) {
-            if (errno == ECHILD) {
-                errno = 0;
-                if (WIFEXITED(last_status)) {
-                    params.status = WEXITSTATUS(last_status);
-                } else if (WIFSIGNALED(last_status)) {
-                    params.status = 128 + WTERMSIG(last_status);
-                }
+        if (wait_reap() < 0) goto err;
 
-                jobs_remove_gid(pgid);
-                goto out;
-            }
-            goto err;
+        int const state = jobs_get_state(jid);
+        if (state == JOB_DONE) {
+            params.status = wait_job_exit_status(jid);
+            timing_report(jid);
+            jobs_remove_gid(pgid);
+            break;
         }
-        assert(res > 0);
-        last_status = status;
-        if (WIFSTOPPED(status)) {
-            fprintf(stderr, "[%jd] Stopped\n", (intmax_t) jobs_get_jid(pgid));
-            goto out;
+        if (state == JOB_STOPPED) {
+            fprintf(stderr, "[%jd] Stopped\n", (intmax_t) jid);
+            jobs_clear_notify(jid);
+            break;
+        }
+
+        int res = wait_sigchld(adaptive ? tick_ms : -1);
+        if (res < 0) goto err;
+        if (res == 0 && adaptive) {
+            /* Back off while nothing needs growing */
+            if (pipe_adapt() == 0 && tick_ms < 64) tick_ms *= 2;
         }
     }
 
-    out:
     if (0) {
         err:
         retval = -1;
     }
 
-    if (isatty(STDIN_FILENO)) {
-        pid_t bspgid = getpgid(0);
-        if (bspgid == -1) return -1;
-        if (tcsetpgrp(STDIN_FILENO, bspgid) == -1) return -1;
-    } else {
-        switch (errno) {
-            case ENOTTY:
-                errno = 0;
-                break;
-            default:
-                return -1;
-        }
-    }
+    fg_jid = -1;
+    if (params.terminal && tcsetpgrp(STDIN_FILENO, shell_pgid) == -1) retval = -1;
+    PROBE4(wait_fg_done, pgid, jid, params.status, stats_end(STATS_WAIT_FG, start));
     return retval;
 }
 
@@ -88,39 +210,78 @@ wait_on_fg_job(jid_t jid) {
 
 int
 wait_on_bg_jobs() {
-    size_t job_count = jobs_get_joblist_size();
-    struct job const *jobs = jobs_get_joblist();
-    for (size_t i = 0; i < job_count; ++i) {
-        pid_t pgid = jobs[i].pgid;
-        jid_t jid = jobs[i].jid;
-        int last_status = 0;
-        for (;;) {
-            int status;
-            pid_t pid = waitpid(-pgid, &status, WSTOPPED | WNOHANG);
-            if (pid == 0) {
-                break;
-            } else if (pid < 0) {
-                if (errno == ECHILD) {
-                    errno = 0;
-                    if (WIFEXITED(last_status)) {
-                        fprintf(stderr, "[%jd] Done\n", (intmax_t) jid);
-                    } else if (WIFSIGNALED(last_status)) {
-                        fprintf(stderr, "[%jd] Terminated\n", (intmax_t) jid);
-                    }
-                    jobs_remove_gid(pgid);
-                    job_count = jobs_get_joblist_size();
-                    jobs = jobs_get_joblist();
-                    break;
-                }
-                return -1;
-            }
+    if (wait_reap() < 0) return -1;
 
-            last_status = status;
-            if (WIFSTOPPED(status)) {
-                fprintf(stderr, "[%jd] Stopped\n", (intmax_t) jid);
-                break;
-            }
+    /* Only jobs that stopped or finished since the last time are looked at */
+    int reported = 0;
+    jid_t jid;
+    while ((jid = jobs_first_notify()) >= 0) {
+        int const state = jobs_get_state(jid);
+        if (state == JOB_RUNNING) {
+            /* Continued from elsewhere since */
+            jobs_clear_notify(jid);
+            continue;
+        }
+        ++reported;
+        if (state == JOB_STOPPED) {
+            fprintf(stderr, "[%jd] Stopped\n", (intmax_t) jid);
+            jobs_clear_notify(jid);
+            continue;
         }
+
+        int status = 0;
+        jobs_get_status(jid, &status);
+        if (WIFSIGNALED(status)) {
+            fprintf(stderr, "[%jd] Terminated\n", (intmax_t) jid);
+        } else {
+            fprintf(stderr, "[%jd] Done\n", (intmax_t) jid);
+        }
+        timing_report(jid);
+        jobs_remove(jid);
+    }
+    return reported;
+}
+
+int
+wait_until(struct timespec deadline) {
+    struct pollfd pfds[2] = {
+            {.fd = sigchld_fd, .events = POLLIN},
+            {.fd = -1, .events = POLLIN},
+    };
+    for (;;) {
+        struct timespec left;
+        clock_gettime(CLOCK_MONOTONIC, &left);
+        left.tv_sec = deadline.tv_sec - left.tv_sec;
+        left.tv_nsec = deadline.tv_nsec - left.tv_nsec;
+        if (left.tv_nsec < 0) {
+            left.tv_nsec += 1000000000L;
+            --left.tv_sec;
+        }
+        if (left.tv_sec < 0) return 0;
+
+        /* A job started meanwhile may have armed the first timeout */
+        pfds[1].fd = timers_fd();
+        int res = ppoll(pfds, 2, &left, 0);
+        if (res < 0) return -1; /* EINTR: e.g. Ctrl-C */
+        if (pfds[1].revents && timers_expire() < 0) return -1;
+        if (pfds[0].revents && wait_reap() < 0) return -1;
+    }
+}
+
+int
+wait_for_input(int fd) {
+    struct pollfd pfds[3] = {
+            {.fd = fd, .events = POLLIN},
+            {.fd = sigchld_fd, .events = POLLIN},
+            {.fd = timers_fd(), .events = POLLIN},
+    };
+    for (;;) {
+        if (poll(pfds, 3, -1) < 0) return -1; /* EINTR: e.g. Ctrl-C */
+        if (pfds[2].revents && timers_expire() < 0) return -1;
+        if (pfds[1].revents) {
+            int reported = wait_on_bg_jobs();
+            if (reported != 0) return reported;
+        }
+        if (pfds[0].revents) return 0;
     }
-    return 0;
 }
@@ -1,7 +1,55 @@
 #pragma once
 
+#include <time.h>
+
 #include "jobs.h"
 
+/** Sets up child reaping
+ *
+ * SIGCHLD must already be blocked (see signal_init()); children are reaped
+ * as their SIGCHLDs are read from a signalfd.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+int wait_init(void);
+
+/** Reaps every child that has changed state, without blocking
+ *
+ * Each wait status is recorded against its process in the job table, then
+ * queued jobs are started if there's room (see run_queued()).
+ *
+ * @returns 0 on success, -1 on failure
+ */
+int wait_reap(void);
+
+/** Blocks until a child changes state
+ *
+ * @returns 0 once one has (reap it with wait_reap()), or a job's timeout was
+ *          handled; -1 on failure. Interrupting signals fail it with EINTR.
+ */
+int wait_for_child(void);
+
+/** Sleeps until a time on CLOCK_MONOTONIC, reaping children and handling
+ *  job timeouts meanwhile
+ *
+ * @returns 0 once it's reached, or -1 on failure. Interrupting signals fail
+ *          it with EINTR.
+ *
+ * Reaping starts queued jobs as others finish (see run_queued()), so a
+ * sleep in the shell doesn't hold them back.
+ */
+int wait_until(struct timespec deadline);
+
+/** Converts a wait status to a shell exit status ($?) */
+int wait_exit_status(int status);
+
+/** Gets a finished job's exit status ($?)
+ *
+ * That of its last process, or 124 if its timeout signalled it (137 if that
+ * took SIGKILL), as with timeout(1).
+ */
+int wait_job_exit_status(jid_t jid);
+
 /** Place a process group in the foreground and wait on it 
  *
  * 
@@ -16,7 +64,22 @@ int wait_on_fg_gid(pid_t pgid);
 int wait_on_fg_job(jid_t jid);
 
 /** Wait (nonblocking) on background jobs 
+ *
+ * Reports and forgets finished jobs, and reports newly stopped ones. Only
+ * those are looked at, so the cost doesn't grow with the number of jobs.
  * 
- * @returns 0 on success, -1 on failure
+ * @returns number of jobs reported, or -1 on failure
  */
 int wait_on_bg_jobs();
+
+/** Waits for input on a file descriptor, reporting background jobs meanwhile
+ *
+ * @returns 0 once input is ready, the number of jobs reported if any were
+ *          (the caller should prompt again), or -1 on failure (e.g. EINTR)
+ *
+ * Data already in a stdio buffer doesn't make the descriptor readable, so
+ * this is only for input read a line at a time, as from a terminal in
+ * canonical mode: each read() returns at most one line, which getline()
+ * then consumes whole, leaving the buffer empty by the next prompt.
+ */
+int wait_for_input(int fd);
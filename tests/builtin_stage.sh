@@ -0,0 +1,40 @@
+#!/bin/sh
+# A builtin pipeline stage run within the shell has its status kept in its
+# job, and all of its output gets through, even once the shell has exited
+# Usage: builtin_stage.sh MINISHELL
+shell=$1
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+status=0
+
+# The time keyword reports on each stage
+"$shell" -c 'time stats bogus | /bin/cat' 2> "$dir/time"
+if ! grep -q '^stats\[0\] *127 ' "$dir/time"; then
+    echo "builtin_stage: no status for the stats stage in: $(cat "$dir/time")"
+    status=1
+fi
+
+# Far more job lines than a 4k pipe holds, read only after the shell is gone,
+# by a reader that outlives the hangup the shell leaves its jobs with
+{
+    echo MS_PIPE_SIZE=4k
+    i=0
+    while [ $i -lt 400 ]; do
+        echo '/bin/sleep 3 &'
+        i=$((i + 1))
+    done
+    cat <<EOF
+jobs | /bin/sh -c 'trap "" HUP; sleep 0.5; wc -l > $dir/lines; mv $dir/lines $dir/count' &
+EOF
+} > "$dir/script"
+"$shell" "$dir/script" > /dev/null 2>&1
+i=0
+while [ ! -e "$dir/count" ] && [ $i -lt 50 ]; do
+    sleep 0.1
+    i=$((i + 1))
+done
+if [ "$(cat "$dir/count" 2>/dev/null)" != 400 ]; then
+    echo "builtin_stage: jobs gave $(cat "$dir/count" 2>/dev/null) of 400 lines"
+    status=1
+fi
+exit $status
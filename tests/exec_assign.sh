@@ -0,0 +1,8 @@
+#!/bin/sh
+# A failed exec leaves the assignments it was given unexported
+# Usage: exec_assign.sh MINISHELL
+out=$("$1" -c 'FOO=1 exec /nonexistent/cmd; /usr/bin/env' 2>/dev/null)
+if printf '%s\n' "$out" | grep -q '^FOO='; then
+    echo "exec_assign: FOO stayed exported after the exec failed"
+    exit 1
+fi
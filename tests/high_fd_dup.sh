@@ -0,0 +1,20 @@
+#!/bin/sh
+# n>&m from a descriptor of 100 and up duplicates it, rather than opening a
+# file named after the number
+# Usage: high_fd_dup.sh MINISHELL
+shell=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+"$shell" -c 'exec 150>log; /bin/echo hi >&150; /bin/echo there 1>&150'
+status=0
+if [ "$(cat log)" != "$(printf 'hi\nthere')" ]; then
+    echo "high_fd_dup: log has '$(cat log)'"
+    status=1
+fi
+if [ -e 150 ]; then
+    echo "high_fd_dup: created a file named 150"
+    status=1
+fi
+exit $status
@@ -0,0 +1,9 @@
+#!/bin/sh
+# A trailing `| cat` is kept once an exec earlier in the list may have
+# pointed stdout somewhere else, a terminal included
+# Usage: optimize_exec.sh MINISHELL
+out=$("$1" --explain-optimizations -c '/bin/echo hi | cat; exec >>/dev/null; /bin/echo hi | cat' 2>&1 >/dev/null)
+if [ "$(printf '%s\n' "$out" | grep -c 'dropped `| cat`')" != 1 ]; then
+    echo "optimize_exec: expected only the first cat dropped, got: $out"
+    exit 1
+fi
@@ -0,0 +1,15 @@
+#!/bin/sh
+# The distributor of a parallel stage keeps a bounded number of descriptors
+# open however many 1 MiB blocks pass through it
+# Usage: parallel_fds.sh MINISHELL
+shell=$1
+status=0
+for op in '|=4' '|*4'; do
+    # Each worker reports how many descriptors its distributor has open
+    most=$("$shell" -c "yes 0123456789abcdef | head -c 64000000 $op sh -c 'ls /proc/\$PPID/fd | wc -l; cat >/dev/null' | sort -n | tail -n 1")
+    if [ -z "$most" ] || [ "$most" -gt 32 ]; then
+        echo "parallel_fds: $op: distributor had ${most:-no} descriptors open"
+        status=1
+    fi
+done
+exit $status
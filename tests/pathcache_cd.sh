@@ -0,0 +1,16 @@
+#!/bin/sh
+# With "." on PATH, a command found elsewhere before cd is looked up again
+# after it, and found in the new directory
+# Usage: pathcache_cd.sh MINISHELL
+shell=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+mkdir "$dir/a" "$dir/b"
+printf '#!/bin/sh\necho shadow\n' > "$dir/b/true"
+chmod +x "$dir/b/true"
+
+out=$(cd "$dir" && "$shell" -c 'PATH=.:/usr/bin:/bin; cd a; true; cd ../b; true')
+if [ "$out" != shadow ]; then
+    echo "pathcache_cd: ./true wasn't run after cd, got '$out'"
+    exit 1
+fi
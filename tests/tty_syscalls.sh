@@ -0,0 +1,24 @@
+#!/bin/sh
+# A script run without a terminal makes no terminal ioctls per command; the
+# check for one is made once, at startup
+# Usage: tty_syscalls.sh MINISHELL
+shell=$1
+syscount=$(dirname "$1")/syscount
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+i=0
+while [ $i -lt 1000 ]; do
+    echo /bin/true
+    i=$((i + 1))
+done > "$dir/script"
+
+"$syscount" "$shell" "$dir/script" < /dev/null 2> "$dir/counts" || {
+    echo "tty_syscalls: the script failed: $(cat "$dir/counts")"
+    exit 1
+}
+tty_ioctls=$(sed -n 's/^tty_ioctls //p' "$dir/counts")
+if [ "${tty_ioctls:-1000}" -gt 10 ]; then
+    echo "tty_syscalls: $tty_ioctls terminal ioctls for 1000 commands"
+    exit 1
+fi
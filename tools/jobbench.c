@@ -0,0 +1,102 @@
+/* Measures the job table with many jobs at once (see src/jobs.h)
+ *
+ * Usage: jobbench [JOBS [ROUNDS]]
+ *
+ * Each round adds JOBS jobs (10000 by default) of two processes each, looks
+ * each up by process group, reports both processes done, and removes the
+ * jobs, in the order the shell would. Prints the mean time per operation for
+ * each step over ROUNDS rounds (20 by default). Built against the shell's
+ * own jobs.c; no processes are started.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "jobs.h"
+
+/* Made-up pids; nothing is signalled or waited for */
+#define FIRST_PID 1000000
+
+enum step { ADD, LOOKUP, UPDATE, REMOVE, STEP_COUNT };
+
+static char const *const step_names[STEP_COUNT] = {
+        [ADD] = "add",
+        [LOOKUP] = "lookup",
+        [UPDATE] = "update",
+        [REMOVE] = "remove",
+};
+
+static double
+now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+int
+main(int argc, char *argv[]) {
+    if (argc > 3) {
+        fprintf(stderr, "Usage: %s [JOBS [ROUNDS]]\n", argv[0]);
+        return 1;
+    }
+    long const count = argc > 1 ? strtol(argv[1], 0, 10) : 10000;
+    long const rounds = argc > 2 ? strtol(argv[2], 0, 10) : 20;
+    if (count <= 0 || rounds <= 0) {
+        fprintf(stderr, "%s: JOBS and ROUNDS must be positive\n", argv[0]);
+        return 1;
+    }
+    jid_t *jids = malloc(sizeof *jids * (size_t) count);
+    if (!jids) {
+        perror("malloc");
+        return 1;
+    }
+
+    double ns[STEP_COUNT] = {0};
+    struct rusage const usage = {0};
+    double const start = now_ns();
+    for (long r = 0; r < rounds; ++r) {
+        double t = now_ns();
+        for (long i = 0; i < count; ++i) {
+            pid_t const pgid = FIRST_PID + 2 * (pid_t) i;
+            jids[i] = jobs_add(pgid);
+            if (jids[i] < 0 || jobs_add_process(jids[i], pgid + 1) < 0) goto err;
+        }
+        ns[ADD] += now_ns() - t;
+
+        t = now_ns();
+        for (long i = 0; i < count; ++i) {
+            if (jobs_get_jid(FIRST_PID + 2 * (pid_t) i) != jids[i]) goto err;
+        }
+        ns[LOOKUP] += now_ns() - t;
+
+        t = now_ns();
+        for (long i = 0; i < count; ++i) {
+            pid_t const pgid = FIRST_PID + 2 * (pid_t) i;
+            if (jobs_update(pgid, 0, &usage) != jids[i] || jobs_update(pgid + 1, 0, &usage) != jids[i]) {
+                goto err;
+            }
+        }
+        ns[UPDATE] += now_ns() - t;
+
+        t = now_ns();
+        for (long i = 0; i < count; ++i) {
+            if (jobs_remove(jids[i]) < 0) goto err;
+        }
+        ns[REMOVE] += now_ns() - t;
+    }
+    double const total = now_ns() - start;
+
+    printf("%ld rounds of %ld jobs: %.3fs\n", rounds, count, total / 1e9);
+    for (int s = 0; s < STEP_COUNT; ++s) {
+        printf("%-8s %8.1f ns/op\n", step_names[s], ns[s] / (double) (rounds * count));
+    }
+    free(jids);
+    jobs_cleanup();
+    return 0;
+
+    err:
+    fprintf(stderr, "%s: job table gave an unexpected result\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,51 @@
+/* Generates a perfect hash table for the core builtins in src/builtins.def
+ *
+ * Usage: mkphash > builtins_phash.h
+ *
+ * Searches for a seed under which every builtin name hashes to its own slot,
+ * growing the table as needed. Slots hold an index into the builtins.def
+ * order plus one; zero marks an empty slot.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util/phash.h"
+
+static char const *const names[] = {
+#define BUILTIN(name, flags) #name,
+#include "builtins.def"
+#undef BUILTIN
+};
+
+enum { COUNT = sizeof names / sizeof *names, MAX_SIZE = 256 };
+
+int
+main(void) {
+    unsigned char slots[MAX_SIZE];
+    uint32_t size = 1;
+    while (size < 2 * COUNT) size *= 2;
+
+    for (; size <= MAX_SIZE; size *= 2) {
+        for (uint32_t seed = 0; seed < 1000000; ++seed) {
+            memset(slots, 0, sizeof slots);
+            size_t i = 0;
+            for (; i < COUNT; ++i) {
+                uint32_t slot = phash(names[i], seed) & (size - 1);
+                if (slots[slot]) break;
+                slots[slot] = (unsigned char) (i + 1);
+            }
+            if (i < COUNT) continue;
+
+            printf("/* Generated by tools/mkphash from src/builtins.def; do not edit */\n");
+            printf("#define BUILTIN_PHASH_SEED %#xu\n", (unsigned) seed);
+            printf("#define BUILTIN_PHASH_SIZE %u\n", (unsigned) size);
+            printf("static unsigned char const builtin_phash_slots[BUILTIN_PHASH_SIZE] = {");
+            for (uint32_t s = 0; s < size; ++s) printf("%s%u", s ? ", " : "", slots[s]);
+            printf("};\n");
+            return 0;
+        }
+    }
+    fprintf(stderr, "mkphash: no perfect hash found\n");
+    return 1;
+}
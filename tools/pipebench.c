@@ -0,0 +1,71 @@
+/* Measures pipeline throughput under each MS_PIPE_SIZE (see src/pipes.h)
+ *
+ * Usage: pipebench SHELL [BYTES]
+ *
+ * Runs `head -c BYTES /dev/zero | cat | wc -c` (3 GB by default) in the
+ * shell with MS_PIPE_SIZE unset, 16k, 256k, 1m and auto, three times each,
+ * and prints the best wall time and the throughput it gives.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUNS 3
+
+static char const *const sizes[] = {0, "16k", "256k", "1m", "auto"};
+
+/** Runs the pipeline once
+ *
+ * @returns wall time in seconds, or -1 on failure
+ */
+static double
+run(char const *shell, char const *size, char const *command) {
+    struct timespec start, end;
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        if (size) setenv("MS_PIPE_SIZE", size, 1);
+        else unsetenv("MS_PIPE_SIZE");
+        if (!freopen("/dev/null", "w", stdout)) _exit(127);
+        execl(shell, shell, "-c", command, (char *) 0);
+        perror(shell);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) return -1;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+int
+main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s SHELL [BYTES]\n", argv[0]);
+        return 1;
+    }
+    char const *bytes = argc > 2 ? argv[2] : "3000000000";
+    char command[128];
+    snprintf(command, sizeof command, "head -c %s /dev/zero | cat | wc -c", bytes);
+    double const total = strtod(bytes, 0);
+
+    printf("%-10s %10s %12s\n", "size", "best", "MB/s");
+    for (size_t i = 0; i < sizeof sizes / sizeof *sizes; ++i) {
+        double best = -1;
+        for (int k = 0; k < RUNS; ++k) {
+            double const t = run(argv[1], sizes[i], command);
+            if (t < 0) {
+                fprintf(stderr, "%s: `%s` failed\n", argv[0], command);
+                return 1;
+            }
+            if (best < 0 || t < best) best = t;
+        }
+        printf("%-10s %9.3fs %12.0f\n", sizes[i] ? sizes[i] : "default", best, total / best / 1e6);
+    }
+    return 0;
+}
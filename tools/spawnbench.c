@@ -0,0 +1,95 @@
+/* Measures launch latency against the launcher's RSS (see src/spawn.h)
+ *
+ * Usage: spawnbench [MAX_MIB]
+ *
+ * Grows its own resident memory in steps up to MAX_MIB (1024 by default) and
+ * at each step times starting and reaping /bin/true with fork() and execv(),
+ * as the shell did, and with posix_spawn(), as it does now. fork() copies
+ * the page tables, so its cost grows with RSS; glibc's posix_spawn() shares
+ * the address space with the child until the exec, so it stays flat.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LAUNCHES 200
+
+extern char **environ;
+
+static char *const true_argv[] = {"/bin/true", 0};
+
+static double
+now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e6 + (double) ts.tv_nsec / 1e3;
+}
+
+static pid_t
+launch_fork(void) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        execv(true_argv[0], true_argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+static pid_t
+launch_spawn(void) {
+    pid_t pid;
+    return posix_spawn(&pid, true_argv[0], 0, 0, true_argv, environ) == 0 ? pid : -1;
+}
+
+/** Times launches
+ *
+ * @returns mean microseconds per launch, or -1 on failure
+ */
+static double
+time_launches(pid_t (*launch)(void)) {
+    double const start = now_us();
+    for (int i = 0; i < LAUNCHES; ++i) {
+        pid_t pid = launch();
+        if (pid < 0 || waitpid(pid, 0, 0) < 0) return -1;
+    }
+    return (now_us() - start) / LAUNCHES;
+}
+
+int
+main(int argc, char *argv[]) {
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [MAX_MIB]\n", argv[0]);
+        return 1;
+    }
+    size_t const max_mib = argc > 1 ? strtoul(argv[1], 0, 10) : 1024;
+
+    printf("%8s %12s %12s\n", "RSS MiB", "fork us", "spawn us");
+    size_t rss_mib = 0;
+    for (size_t step = 0; step <= max_mib; step = step ? step * 4 : 16) {
+        /* Touched, so it's resident; never freed */
+        if (step > rss_mib) {
+            size_t const size = (step - rss_mib) << 20;
+            char *p = malloc(size);
+            if (!p) {
+                perror("malloc");
+                return 1;
+            }
+            memset(p, 1, size);
+            rss_mib = step;
+        }
+        double const fork_us = time_launches(launch_fork);
+        double const spawn_us = time_launches(launch_spawn);
+        if (fork_us < 0 || spawn_us < 0) {
+            perror("launch");
+            return 1;
+        }
+        printf("%8zu %12.1f %12.1f\n", rss_mib, fork_us, spawn_us);
+    }
+    return 0;
+}
@@ -0,0 +1,72 @@
+/* Counts the system calls a program makes itself, strace -c style
+ *
+ * Usage: syscount PROGRAM [ARG...]
+ *
+ * Runs PROGRAM under ptrace, without following its children, and prints to
+ * stderr how many system calls it made and how many of them were terminal
+ * ioctls (isatty(), tcgetpgrp(), tcsetpgrp() and the like), then exits with
+ * PROGRAM's status. Used by tests/tty_syscalls.sh.
+ */
+#define _GNU_SOURCE
+
+#include <signal.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Terminal ioctl requests are 'T' << 8 | n */
+#define IS_TTY_IOCTL(request) (((request) & 0xff00) == ('T' << 8))
+
+int
+main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s PROGRAM [ARG...]\n", argv[0]);
+        return 1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0) {
+        ptrace(PTRACE_TRACEME, 0, 0, 0);
+        raise(SIGSTOP);
+        execvp(argv[1], argv + 1);
+        perror(argv[1]);
+        _exit(127);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status)) goto err;
+    if (ptrace(PTRACE_SETOPTIONS, pid, 0, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL) < 0) goto err;
+
+    long syscalls = 0, tty_ioctls = 0;
+    int sig = 0;
+    for (;;) {
+        if (ptrace(PTRACE_SYSCALL, pid, 0, sig) < 0) goto err;
+        if (waitpid(pid, &status, 0) < 0) goto err;
+        if (WIFEXITED(status) || WIFSIGNALED(status)) break;
+        sig = 0;
+        /* Event stops, such as the exec's, carry no signal to pass on */
+        if (status >> 16) continue;
+        if (WSTOPSIG(status) != (SIGTRAP | 0x80)) {
+            sig = WSTOPSIG(status);
+            continue;
+        }
+        struct __ptrace_syscall_info info;
+        if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof info, &info) < 0) goto err;
+        if (info.op != PTRACE_SYSCALL_INFO_ENTRY) continue;
+        ++syscalls;
+        if (info.entry.nr == SYS_ioctl && IS_TTY_IOCTL(info.entry.args[1])) ++tty_ioctls;
+    }
+
+    fprintf(stderr, "syscalls %ld\ntty_ioctls %ld\n", syscalls, tty_ioctls);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+
+    err:
+    perror(argv[0]);
+    return 1;
+}
@@ -0,0 +1,219 @@
+/* Converts an MS_TRACE file to Chrome trace JSON (see src/trace.h)
+ *
+ * Usage: tracedecode TRACE > trace.json
+ *
+ * Load the output in chrome://tracing or ui.perfetto.dev. The shell's own
+ * work (reading, parsing, expanding, spawning) shows as slices on its
+ * process; each child gets a process of its own, spanning from its fork or
+ * spawn to its exit; jobs show as async slices from being added to being
+ * removed.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "trace.h"
+
+/* A child seen starting, until it's seen exiting */
+struct child {
+    int32_t pid;
+    uint64_t start;
+    char name[sizeof ((struct trace_record *) 0)->name + 1];
+};
+
+static struct child *children = 0;
+static size_t child_count = 0;
+static uint64_t base = 0; /* Earliest timestamp; output starts from zero */
+
+static int
+by_time(void const *a, void const *b) {
+    struct trace_record const *x = a;
+    struct trace_record const *y = b;
+    return (x->ts > y->ts) - (x->ts < y->ts);
+}
+
+static double
+us(uint64_t ns) {
+    return (double) (ns - base) / 1e3;
+}
+
+/** Prints a string as JSON, without the quotes */
+static void
+print_json_str(char const *s, size_t max) {
+    for (size_t i = 0; i < max && s[i]; ++i) {
+        unsigned char const c = (unsigned char) s[i];
+        if (c == '"' || c == '\\') printf("\\%c", c);
+        else if (c < 0x20) printf("\\u%04x", c);
+        else putchar(c);
+    }
+}
+
+static struct child *
+find_child(int32_t pid) {
+    for (size_t i = child_count; i-- > 0;) {
+        if (children[i].pid == pid) return &children[i];
+    }
+    return 0;
+}
+
+/** Notes a child starting, or renames it if already known (e.g. on exec) */
+static void
+start_child(int32_t pid, uint64_t ts, char const *name) {
+    struct child *c = find_child(pid);
+    if (!c) {
+        void *tmp = realloc(children, sizeof *children * (child_count + 1));
+        if (!tmp) {
+            perror("tracedecode");
+            exit(1);
+        }
+        children = tmp;
+        c = &children[child_count++];
+        c->pid = pid;
+        c->start = ts;
+    }
+    if (name[0]) {
+        memcpy(c->name, name, sizeof c->name - 1);
+        c->name[sizeof c->name - 1] = '\0';
+    }
+}
+
+static int first = 1;
+
+/** Starts an event object, with the fields every event has */
+static void
+begin_event(char const *ph, char const *name, char const *detail, int32_t pid, uint64_t ts) {
+    printf("%s\n{\"ph\":\"%s\",\"pid\":%ld,\"tid\":%ld,\"ts\":%.3f,\"name\":\"%s",
+           first ? "" : ",", ph, (long) pid, (long) pid, us(ts), name);
+    if (detail && detail[0]) {
+        putchar(' ');
+        print_json_str(detail, sizeof ((struct trace_record *) 0)->name);
+    }
+    putchar('"');
+    first = 0;
+}
+
+/** Prints a slice that ended at the record's time */
+static void
+slice(struct trace_record const *r, char const *name, char const *detail) {
+    begin_event("X", name, detail, r->pid, r->ts - r->dur);
+    printf(",\"dur\":%.3f", (double) r->dur / 1e3);
+}
+
+static void
+decode(struct trace_record const *r) {
+    switch (r->type) {
+        case TRACE_LINE_READ:
+            slice(r, "read", 0);
+            printf(",\"args\":{\"bytes\":%ld}}", (long) r->a);
+            break;
+        case TRACE_PARSE_DONE:
+            slice(r, "parse", 0);
+            printf(",\"args\":{\"result\":%ld}}", (long) r->a);
+            break;
+        case TRACE_EXPAND:
+            slice(r, "expand", r->name);
+            putchar('}');
+            break;
+        case TRACE_FORK:
+            begin_event("i", "fork", r->name, r->pid, r->ts);
+            printf(",\"s\":\"t\",\"args\":{\"child\":%ld,\"pgid\":%ld}}", (long) r->a, (long) r->b);
+            start_child(r->a, r->ts, r->name);
+            break;
+        case TRACE_EXEC:
+            if (r->pid == r->a) {
+                /* From the forked child itself */
+                begin_event("i", "exec", r->name, r->pid, r->ts);
+                printf(",\"s\":\"t\"}");
+            } else {
+                slice(r, "spawn", r->name);
+                printf(",\"args\":{\"child\":%ld,\"pgid\":%ld}}", (long) r->a, (long) r->b);
+            }
+            start_child(r->a, r->ts, r->name);
+            break;
+        case TRACE_EXIT: {
+            struct child const *c = find_child(r->a);
+            if (!c) break; /* Started before the ring's oldest record */
+            begin_event("X", c->name, 0, r->a, c->start);
+            printf(",\"dur\":%.3f,\"args\":{", (double) (r->ts - c->start) / 1e3);
+            if (WIFSIGNALED(r->b)) printf("\"signal\":%d}}", WTERMSIG(r->b));
+            else printf("\"status\":%d}}", WEXITSTATUS(r->b));
+            printf(",\n{\"ph\":\"M\",\"pid\":%ld,\"name\":\"process_name\",\"args\":{\"name\":\"",
+                   (long) r->a);
+            print_json_str(c->name, sizeof c->name);
+            printf(" [%ld]\"}}", (long) r->a);
+            break;
+        }
+        case TRACE_STOP:
+        case TRACE_CONT:
+            begin_event("i", r->type == TRACE_STOP ? "stop" : "continue", 0, r->a, r->ts);
+            printf(",\"s\":\"p\"}");
+            break;
+        case TRACE_JOB_ADD:
+        case TRACE_JOB_REMOVE:
+            printf("%s\n{\"ph\":\"%s\",\"cat\":\"job\",\"id\":\"%ld:%ld\",\"pid\":%ld,\"tid\":%ld,"
+                   "\"ts\":%.3f,\"name\":\"job %ld\"}",
+                   first ? "" : ",", r->type == TRACE_JOB_ADD ? "b" : "e",
+                   (long) r->a, (long) r->b, (long) r->pid, (long) r->pid, us(r->ts), (long) r->a);
+            first = 0;
+            break;
+        default:
+            break;
+    }
+}
+
+int
+main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s TRACE > trace.json\n", argv[0]);
+        return 2;
+    }
+    FILE *f = fopen(argv[1], "rb");
+    if (!f) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    struct trace_header h;
+    if (fread(&h, sizeof h, 1, f) != 1 || memcmp(h.magic, TRACE_MAGIC, sizeof h.magic) != 0 ||
+        h.record_size != sizeof(struct trace_record)) {
+        fprintf(stderr, "%s: not a trace from this version of minishell\n", argv[1]);
+        return 1;
+    }
+    struct trace_record *records = malloc(sizeof *records * h.capacity);
+    if (!records) {
+        perror("tracedecode");
+        return 1;
+    }
+    size_t n = fread(records, sizeof *records, h.capacity, f);
+    fclose(f);
+
+    /* Keep the published records, oldest first */
+    size_t kept = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (records[i].type != TRACE_NONE && records[i].type < TRACE_TYPE_COUNT) {
+            records[kept++] = records[i];
+        }
+    }
+    qsort(records, kept, sizeof *records, by_time);
+    if (h.head > h.capacity) {
+        fprintf(stderr, "%s: %llu oldest events were overwritten\n", argv[1],
+                (unsigned long long) (h.head - h.capacity));
+    }
+
+    /* Slices end at their record's time; start from the earliest start */
+    base = kept ? records[0].ts : 0;
+    for (size_t i = 0; i < kept; ++i) {
+        if (records[i].ts - records[i].dur < base) base = records[i].ts - records[i].dur;
+    }
+
+    printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (size_t i = 0; i < kept; ++i) decode(&records[i]);
+    printf("\n]}\n");
+    free(records);
+    free(children);
+    return 0;
+}